@@ -0,0 +1,51 @@
+#ifndef __actions_h_included__
+#define __actions_h_included__
+
+// What a page does with an encoder event. The action table of the current
+// page is built when the page is selected, so everything the report needs
+// (byte offset and bit mask of a button, the axis and its step) is already
+// worked out when an event is dispatched.
+
+#define ACT_NONE          0
+#define ACT_PRESS         1 // set bit 'value' in report byte 'index'
+#define ACT_RELEASE       2 // clear it again
+#define ACT_TAP           3 // set it and release it after the release delay
+#define ACT_AXIS_INC      4 // add 'value' to axis 'index'
+#define ACT_AXIS_DEC      5 // subtract 'value' from axis 'index'
+#define ACT_PAGE_NEXT     6
+#define ACT_PAGE_PREVIOUS 7
+#define ACT_PAGE_SELECT   8 // go to page 'index'
+#define ACT_SHIFT_ON      9 // dials report to the shifted stick
+#define ACT_SHIFT_OFF     10
+
+typedef struct {
+	uchar type;
+	uchar index;
+	axisValue_t value;
+} action_t;
+
+// buttons are numbered 1..24 like in the report descriptor
+#define BUTTON_BYTE(n) (1 + ((n)-1) / 8)
+#define BUTTON_MASK(n) (1 << (((n)-1) % 8))
+
+#define NOTHING           { ACT_NONE, 0, 0 }
+#define PRESS(n)          { ACT_PRESS, BUTTON_BYTE(n), BUTTON_MASK(n) }
+#define RELEASE(n)        { ACT_RELEASE, BUTTON_BYTE(n), BUTTON_MASK(n) }
+#define TAP(n)            { ACT_TAP, BUTTON_BYTE(n), BUTTON_MASK(n) }
+#define AXIS_INC(a, step) { ACT_AXIS_INC, (a), (step) }
+#define AXIS_DEC(a, step) { ACT_AXIS_DEC, (a), (step) }
+#define PAGE_NEXT         { ACT_PAGE_NEXT, 0, 0 }
+#define PAGE_PREVIOUS     { ACT_PAGE_PREVIOUS, 0, 0 }
+#define PAGE(p)           { ACT_PAGE_SELECT, (p), 0 }
+#define SHIFT_ON          { ACT_SHIFT_ON, 0, 0 }
+#define SHIFT_OFF         { ACT_SHIFT_OFF, 0, 0 }
+
+// one row per encoder, one entry per event bit:
+// button down, button up, left, right, short press, long press, double click
+// The dial rows are compiled from the profile's bindings, see compilePage().
+
+// page selector: turn to change pages, hold for the shift layer, click for page 1
+#define PAGE_SELECTOR \
+	{ SHIFT_ON, SHIFT_OFF, PAGE_PREVIOUS, PAGE_NEXT, PAGE(1), NOTHING, NOTHING }
+
+#endif
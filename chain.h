@@ -0,0 +1,45 @@
+#ifndef __chain_h_included__
+#define __chain_h_included__
+
+// Unpacking the 74HC165 chain into encoder states, generated from the
+// layout in numsticks.h. Every encoder number is a constant, so each one
+// compiles to the one or two shifts hand written code would use; nothing
+// is computed at run time.
+
+#include <stdint.h>
+#include "numsticks.h"
+
+#if NUMBER_OF_ENCODERS > 24
+#error "chain_unpack() handles up to 24 encoders"
+#endif
+#if ENCODER_CHAIN_BIT(NUMBER_OF_ENCODERS - 1) + 3 > 8 * CHAIN_BYTES
+#error "the encoders do not fit into CHAIN_BYTES"
+#endif
+
+#define CHAIN_BYTE(n) (ENCODER_CHAIN_BIT(n) / 8)
+#define CHAIN_POS(n)  (ENCODER_CHAIN_BIT(n) % 8)
+
+// state of encoder n in the low three bits, the bits above are left over
+// from its neighbours (encoder_events() masks them). Bits 6 and 7 of a
+// byte straddle into the next one. The shift counts are masked so that
+// the branch not taken stays valid as well.
+#define CHAIN_STATE(chain, n) ((uint8_t)(CHAIN_POS(n) <= 5 \
+	? (chain)[CHAIN_BYTE(n)] >> ((5 - CHAIN_POS(n)) & 7) \
+	: ((chain)[CHAIN_BYTE(n)] << ((CHAIN_POS(n) + 3) & 7)) \
+	  | ((chain)[CHAIN_BYTE(n) + 1 < CHAIN_BYTES ? CHAIN_BYTE(n) + 1 : 0] >> ((13 - CHAIN_POS(n)) & 7))))
+
+// encoders past NUMBER_OF_ENCODERS drop out at compile time
+#define CHAIN_UNPACK(n) \
+	if ((n) < NUMBER_OF_ENCODERS) \
+		states[(n) < NUMBER_OF_ENCODERS ? (n) : 0] = CHAIN_STATE(chain, (n) < NUMBER_OF_ENCODERS ? (n) : 0);
+
+static inline __attribute__((always_inline)) void chain_unpack(const uint8_t *chain, uint8_t *states) {
+	CHAIN_UNPACK(0)  CHAIN_UNPACK(1)  CHAIN_UNPACK(2)  CHAIN_UNPACK(3)
+	CHAIN_UNPACK(4)  CHAIN_UNPACK(5)  CHAIN_UNPACK(6)  CHAIN_UNPACK(7)
+	CHAIN_UNPACK(8)  CHAIN_UNPACK(9)  CHAIN_UNPACK(10) CHAIN_UNPACK(11)
+	CHAIN_UNPACK(12) CHAIN_UNPACK(13) CHAIN_UNPACK(14) CHAIN_UNPACK(15)
+	CHAIN_UNPACK(16) CHAIN_UNPACK(17) CHAIN_UNPACK(18) CHAIN_UNPACK(19)
+	CHAIN_UNPACK(20) CHAIN_UNPACK(21) CHAIN_UNPACK(22) CHAIN_UNPACK(23)
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include <string.h>
+#include <util/crc16.h>
+#include "config.h"
+#include "profile.h"
+
+static uint8_t report[CONFIG_REPORT_SIZE];
+static uint8_t received;
+
+static uint8_t status = CFG_OK;
+static uint8_t *staged;
+static uint8_t stagedPage;
+static uint8_t readOffset;
+static uint8_t committed = 0xff;
+
+static uint8_t checksum(uint8_t *data) {
+	uint8_t sum = 0;
+	for (uint8_t i = 1; i < CONFIG_REPORT_SIZE - 1; i++)
+		sum += data[i];
+	return -sum;
+}
+
+static uint8_t execute(void) {
+	uint8_t page = report[2];
+	uint8_t offset = report[3];
+	uint8_t len = report[4];
+	uint8_t *data = &report[5];
+
+	if (report[CONFIG_REPORT_SIZE - 1] != checksum(report)) return CFG_BAD_CHECKSUM;
+
+	switch (report[1]) {
+		case CFG_BEGIN:
+			staged = profile_stage(page);
+			if (!staged) return CFG_BUSY;
+			stagedPage = page;
+			return CFG_OK;
+		case CFG_WRITE:
+			if (!staged) return CFG_NOT_STAGED;
+			if ((len > CONFIG_DATA_SIZE) || (offset + len > profile_stage_size(stagedPage)))
+				return CFG_BAD_COMMAND;
+			memcpy(staged + offset, data, len);
+			return CFG_OK;
+		case CFG_READ:
+			readOffset = offset;
+			return CFG_OK;
+		case CFG_COMMIT: {
+			if (!staged) return CFG_NOT_STAGED;
+			uint16_t crc = 0xffff;
+			for (uint8_t i = 0; i < profile_stage_size(stagedPage); i++)
+				crc = _crc16_update(crc, staged[i]);
+			if (crc != (data[0] | (data[1] << 8))) return CFG_BAD_CRC;
+			if (!profile_staged_valid()) return CFG_BAD_COMMAND;
+			if (!profile_commit()) return CFG_BUSY;
+			staged = 0;
+			committed = stagedPage;
+			return CFG_OK;
+		}
+	}
+	return CFG_BAD_COMMAND;
+}
+
+void config_begin(void) {
+	received = 0;
+}
+
+uint8_t config_write(uint8_t *data, uint8_t len) {
+	while (len-- && received < CONFIG_REPORT_SIZE)
+		report[received++] = *data++;
+	if (received < CONFIG_REPORT_SIZE) return 0;
+	status = execute();
+	return 1;
+}
+
+uint8_t *config_report(uint8_t reportId) {
+	report[0] = reportId;
+	report[1] = status;
+	report[2] = staged ? stagedPage : 0xff;
+	report[3] = readOffset;
+	report[4] = 0;
+	if (staged) {
+		uint8_t size = profile_stage_size(stagedPage);
+		uint8_t len = readOffset < size ? size - readOffset : 0;
+		if (len > CONFIG_DATA_SIZE) len = CONFIG_DATA_SIZE;
+		memcpy(&report[5], staged + readOffset, len);
+		report[4] = len;
+	}
+	report[CONFIG_REPORT_SIZE - 1] = checksum(report);
+	return report;
+}
+
+uint8_t config_take_committed(void) {
+	uint8_t page = committed;
+	committed = 0xff;
+	return page;
+}
@@ -0,0 +1,49 @@
+#ifndef __config_h_included__
+#define __config_h_included__
+
+#include <stdint.h>
+
+// Configuration protocol on a vendor defined HID feature report.
+//
+// Every SET_REPORT carries one command, every GET_REPORT returns the result
+// of the last command. Report layout (CONFIG_REPORT_SIZE bytes):
+//   [0]     report ID
+//   [1]     command (SET) / status (GET)
+//   [2]     page: 1..PROFILE_PAGES, 0 for the scan settings
+//   [3]     offset into the page (profile_page_t / profile_settings_t)
+//   [4]     number of data bytes
+//   [5..30] data
+//   [31]    checksum: bytes 1..31 add up to 0 (mod 256)
+//
+// CFG_BEGIN followed by CFG_READ also reads a page back.
+// A page is changed by CFG_BEGIN, any number of CFG_WRITE and a CFG_COMMIT
+// whose first two data bytes hold the CRC-16 (poly 0xa001, init 0xffff,
+// little endian) of the whole staged page. Nothing changes before the
+// commit, and the commit swaps in the new page at once.
+
+#define CONFIG_REPORT_SIZE 32
+#define CONFIG_DATA_SIZE   26
+
+#define CFG_BEGIN  1 // stage the current contents of 'page'
+#define CFG_WRITE  2 // copy data to 'offset' of the staged page
+#define CFG_READ   3 // next GET_REPORT returns data from 'offset'
+#define CFG_COMMIT 4 // check the CRC and make the staged page active
+
+#define CFG_OK           0
+#define CFG_BAD_CHECKSUM 1
+#define CFG_BAD_COMMAND  2 // also a commit with a binding that is not valid
+#define CFG_BUSY         3 // previous commit still being saved, try again
+                           // (also for a CFG_COMMIT, the page stays staged)
+#define CFG_BAD_CRC      4
+#define CFG_NOT_STAGED   5
+
+// SET_REPORT for the config report, the data follows through config_write()
+void config_begin(void);
+// usbFunctionWrite() for the config report, returns 1 when the report is complete
+uint8_t config_write(uint8_t *data, uint8_t len);
+// contents for GET_REPORT
+uint8_t *config_report(uint8_t reportId);
+// page committed since the last call (0xff: none), so it can be redrawn
+uint8_t config_take_committed(void);
+
+#endif
@@ -0,0 +1,173 @@
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "diag.h"
+#include "encoder.h"
+#include "profile.h"
+#include "state.h"
+#include "profiler.h"
+#include "latency.h"
+#include "trace.h"
+#include "stack.h"
+
+typedef struct {
+	uint8_t id;
+	uint8_t *data;
+	uint16_t len;
+} diag_section_t;
+
+static const diag_section_t sections[] PROGMEM = {
+	{ DIAG_ENCODER_STATS, (uint8_t *)encoder_stats, sizeof(encoder_stats) },
+#if DIAG_PROFILER
+	{ DIAG_PROFILER_STATS, (uint8_t *)profiler_stages, sizeof(profiler_stages) },
+#endif
+#if DIAG_LATENCY
+	{ DIAG_LATENCY_STATS, (uint8_t *)&latency_stats, sizeof(latency_stats) },
+#endif
+#if DIAG_STACK
+	{ DIAG_STACK_STATS, (uint8_t *)&stack_stats, sizeof(stack_stats) },
+#endif
+};
+#define SECTION_COUNT (sizeof(sections) / sizeof(sections[0]))
+#define SECTION_HEADER 3
+
+// position in the GET_STATS stream
+static uint8_t streamSection;
+static uint16_t streamPos;
+static diag_section_t current;
+#if DIAG_TRACE
+static uint8_t streamTrace; // GET_TRACE instead of GET_STATS
+#endif
+
+static diag_config_t config;
+
+#if DIAG_TIMER
+void diag_timer_init(void) {
+	TCCR1A = 0;
+	TCCR1B = (1<<CS11) | (1<<CS10); // CK/64
+}
+
+void diag_hist_reset(diag_hist_t *hist, uint8_t count) {
+	memset(hist, 0, count * sizeof(diag_hist_t));
+	for (uint8_t i=0; i<count; i++)
+		hist[i].min = 0xffff;
+}
+
+void diag_hist_add(diag_hist_t *hist, uint16_t ticks) {
+	if (ticks < hist->min) hist->min = ticks;
+	if (ticks > hist->max) hist->max = ticks;
+
+	uint8_t b = 0;
+	while ((ticks >>= 1) && (b < DIAG_HIST_BUCKETS-1)) b++;
+	if (++hist->buckets[b] == 0xffff) {
+		for (b=0; b<DIAG_HIST_BUCKETS; b++)
+			hist->buckets[b] >>= 1;
+	}
+}
+#endif
+
+static void resetStats(void) {
+	encoder_reset_stats();
+#if DIAG_PROFILER
+	profiler_reset();
+#endif
+#if DIAG_LATENCY
+	latency_reset();
+#endif
+}
+
+usbMsgLen_t diag_setup(uint8_t request, uint16_t value, uint16_t length, uint8_t **reply) {
+#if DIAG_TRACE
+	// a trace read that the host gave up on must not stop recording
+	trace_read_stop();
+	streamTrace = 0;
+#endif
+	switch (request) {
+		case RQ_GET_STATS:
+#if DIAG_STACK
+			stack_probe();
+#endif
+			streamSection = 0;
+			streamPos = 0;
+			memcpy_P(&current, &sections[0], sizeof(current));
+			return USB_NO_MSG;
+		case RQ_RESET_STATS:
+			resetStats();
+			return 0;
+		case RQ_GET_TRACE:
+#if DIAG_TRACE
+			trace_read_start(length);
+			streamTrace = 1;
+			return USB_NO_MSG;
+#else
+			return 0;
+#endif
+		case RQ_FREEZE_TRACE:
+#if DIAG_TRACE
+			if (value) trace_freeze();
+			else trace_rearm();
+#endif
+			return 0;
+		case RQ_GET_CONFIG:
+			config.version = DIAG_VERSION;
+			config.sticks = NUMBER_OF_STICKS;
+			config.reportIds = REPORT_ID_MAX;
+			config.encoders = NUMBER_OF_ENCODERS;
+			config.axisBits = AXIS_BITS;
+			config.shiftLayer = SHIFT_LAYER;
+#ifdef ENCODER_RESOLUTION
+			config.resolution = ENCODER_RESOLUTION;
+#else
+			config.resolution = 0;
+#endif
+			config.profileVersion = PROFILE_VERSION;
+			config.stateSticks = state_sticks;
+			config.options = 0
+#if DIAG_PROFILER
+				| DIAG_OPTION_PROFILER
+#endif
+#if DIAG_LATENCY
+				| DIAG_OPTION_LATENCY
+#endif
+#if DIAG_SOF_STAMP
+				| DIAG_OPTION_SOF_STAMP
+#endif
+#if DIAG_TRACE
+				| DIAG_OPTION_TRACE
+#endif
+#if DIAG_STACK
+				| DIAG_OPTION_STACK
+#endif
+				;
+			config.axisPages = AXIS_PAGES;
+			config.profilePages = PROFILE_PAGES;
+			config.pageRam = PAGE_RAM_BYTES;
+			config.axisPageRam = AXIS_PAGE_RAM_BYTES;
+			*reply = (uint8_t *)&config;
+			return sizeof(config);
+	}
+	return 0;
+}
+
+uint8_t diag_read(uint8_t *data, uint8_t len) {
+#if DIAG_TRACE
+	if (streamTrace) return trace_read(data, len);
+#endif
+	uint8_t i = 0;
+	while ((i < len) && (streamSection < SECTION_COUNT)) {
+		if (streamPos == 0)
+			data[i] = current.id;
+		else if (streamPos == 1)
+			data[i] = current.len & 0xff;
+		else if (streamPos == 2)
+			data[i] = current.len >> 8;
+		else
+			data[i] = current.data[streamPos - SECTION_HEADER];
+		i++;
+		if (++streamPos == SECTION_HEADER + current.len) {
+			streamPos = 0;
+			if (++streamSection < SECTION_COUNT)
+				memcpy_P(&current, &sections[streamSection], sizeof(current));
+		}
+	}
+	return i;
+}
@@ -0,0 +1,103 @@
+#ifndef __diag_h_included__
+#define __diag_h_included__
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "usbdrv.h"
+
+// compile time options, off by default as they cost RAM and cycles. The
+// stack check is the exception: 6 bytes of RAM for stack_stats and one pass
+// over the free RAM at reset buy the only measure of how close the stack
+// comes to the data in 1 KB, and it costs nothing in the main loop as it
+// is probed only when the host asks (DIAG_STACK_STATS).
+#define DIAG_PROFILER 0 // main loop stage timing, see profiler.h
+#define DIAG_LATENCY  0 // scan to usbSetInterrupt() delay, see latency.h
+#define DIAG_TRACE    0 // event trace ring, see trace.h
+#define DIAG_TRACE_SIZE 128
+#ifndef HAL_HOST
+#define DIAG_STACK    1 // stack high water mark, see stack.h
+#else
+#define DIAG_STACK    0
+#endif
+// puts usbSofCount into the third button byte of every report, buttons
+// 17..24 are not reported then and dials bound to them do nothing. Needs USB_COUNT_SOF, which needs D- wired
+// to INT0 instead of D+ (see usbconfig.h).
+#define DIAG_SOF_STAMP 0
+
+#if DIAG_SOF_STAMP && !USB_COUNT_SOF
+#error "DIAG_SOF_STAMP needs USB_COUNT_SOF"
+#endif
+
+// Timer1 runs free at F_CPU/64 (3.2us per tick at 20MHz) for the options
+// that measure durations
+#define DIAG_TIMER (DIAG_PROFILER || DIAG_LATENCY)
+
+// min, max and log2 histogram of durations in timer ticks. Bucket n
+// counts 2^n to 2^(n+1)-1 ticks, the last one everything longer. When a
+// bucket overflows, all buckets are halved so the shape is kept.
+#define DIAG_HIST_BUCKETS 12
+
+typedef struct {
+	uint16_t min;
+	uint16_t max;
+	uint16_t buckets[DIAG_HIST_BUCKETS];
+} diag_hist_t;
+
+#if DIAG_TIMER
+#define DIAG_TICKS() TCNT1
+void diag_timer_init(void);
+void diag_hist_reset(diag_hist_t *hist, uint8_t count);
+void diag_hist_add(diag_hist_t *hist, uint16_t ticks);
+#endif
+
+// Vendor specific control requests for diagnostics. Replies longer than
+// the setup buffer are streamed through usbFunctionRead(), so a host can
+// read everything with one control transfer (wLength up to 65535, see
+// USB_CFG_LONG_TRANSFERS) while the interrupt endpoint keeps sending
+// reports.
+
+#define RQ_GET_STATS   1 // all statistics, as sections (see below)
+#define RQ_RESET_STATS 2
+#define RQ_GET_TRACE   3 // contents of the event trace, see trace.h
+#define RQ_GET_CONFIG  4 // diag_config_t
+#define RQ_FREEZE_TRACE 5 // wValue 1: freeze the trace, 0: clear and rearm it
+
+// GET_STATS reply: a sequence of sections, each one byte ID, two bytes
+// length (little endian) and the data
+#define DIAG_ENCODER_STATS  1 // encoder_stats_t[NUMBER_OF_ENCODERS]
+#define DIAG_PROFILER_STATS 2 // diag_hist_t[PROF_STAGES]
+#define DIAG_LATENCY_STATS  3 // diag_hist_t
+#define DIAG_STACK_STATS    4 // stack_stats_t
+
+typedef struct {
+	uint8_t version;         // DIAG_VERSION
+	uint8_t sticks;          // NUMBER_OF_STICKS
+	uint8_t reportIds;       // REPORT_ID_MAX, the vendor reports follow
+	uint8_t encoders;        // NUMBER_OF_ENCODERS
+	uint8_t axisBits;        // AXIS_BITS
+	uint8_t shiftLayer;      // SHIFT_LAYER
+	uint8_t resolution;      // ENCODER_RESOLUTION, 0: per encoder (see settings)
+	uint8_t profileVersion;  // PROFILE_VERSION
+	uint8_t stateSticks;     // sticks whose axes survive a power cycle
+	uint8_t options;         // DIAG_OPTION_* compiled in
+	uint8_t axisPages;       // AXIS_PAGES, the others are button pages
+	uint8_t profilePages;    // PROFILE_PAGES, pages with their own profile
+	uint8_t pageRam;         // PAGE_RAM_BYTES, report storage of a button page
+	uint8_t axisPageRam;     // AXIS_PAGE_RAM_BYTES, of an axis page
+} diag_config_t;
+
+#define DIAG_VERSION 2
+
+// diag_config_t.options
+#define DIAG_OPTION_PROFILER  (1<<0)
+#define DIAG_OPTION_LATENCY   (1<<1)
+#define DIAG_OPTION_SOF_STAMP (1<<2)
+#define DIAG_OPTION_TRACE     (1<<3)
+#define DIAG_OPTION_STACK     (1<<4)
+
+// returns the reply length, USB_NO_MSG for streamed replies
+usbMsgLen_t diag_setup(uint8_t request, uint16_t value, uint16_t length, uint8_t **reply);
+// usbFunctionRead() for streamed replies
+uint8_t diag_read(uint8_t *data, uint8_t len);
+
+#endif
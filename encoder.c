@@ -1,6 +1,61 @@
+#include <string.h>
 #include "encoder.h"
+#include "trace.h"
 
-uint8_t encoder_events(uint8_t oldstate, uint8_t newstate) {
+encoder_stats_t encoder_stats[NUMBER_OF_ENCODERS];
+
+// direction of the last valid transition per encoder (ECEV_LEFT, ECEV_RIGHT or 0)
+static uint8_t lastdir[NUMBER_OF_ENCODERS];
+// an event carries one step per direction: when a skipped state and the new
+// one are both detents, the second step is owed and goes out on a later call
+static uint8_t owedSteps[NUMBER_OF_ENCODERS];
+static uint8_t owedDir[NUMBER_OF_ENCODERS];
+
+// position of each state along the cycle NORTH -> EAST -> SOUTH -> WEST,
+// indexed by the state bits; moving forward along this cycle is ECEV_LEFT
+static const uint8_t position[4] = {
+	2, // ECST_SOUTH
+	1, // ECST_EAST
+	3, // ECST_WEST
+	0, // ECST_NORTH
+};
+
+#define IS_DETENT(mask, pos) ((mask) & (1 << (pos)))
+
+#ifdef ENCODER_RESOLUTION
+#define detents(encoder) ENCODER_DETENT_MASK(ENCODER_RESOLUTION)
+#else
+static uint8_t resolution[NUMBER_OF_ENCODERS] = { ENCODER_RESOLUTIONS };
+static const uint8_t detentmask[5] = {
+	0, ENCODER_DETENT_MASK(1), ENCODER_DETENT_MASK(2), 0, ENCODER_DETENT_MASK(4)
+};
+#define detents(encoder) detentmask[resolution[encoder]]
+
+void encoder_set_resolution(uint8_t encoder, uint8_t res) {
+	if ((res == 1 || res == 2 || res == 4) && res != resolution[encoder]) {
+		resolution[encoder] = res;
+		encoder_reset(encoder); // owed steps were counted with the old detents
+	}
+}
+
+uint8_t encoder_get_resolution(uint8_t encoder) {
+	return resolution[encoder];
+}
+#endif
+
+static void count(uint16_t *counter) {
+	if (*counter != 0xffff) (*counter)++;
+}
+
+void encoder_reset(uint8_t encoder) {
+	lastdir[encoder] = owedSteps[encoder] = owedDir[encoder] = 0;
+}
+
+void encoder_reset_stats(void) {
+	memset(encoder_stats, 0, sizeof(encoder_stats));
+}
+
+uint8_t encoder_events(uint8_t encoder, uint8_t oldstate, uint8_t newstate) {
    	uint8_t retevent = 0x00;
 	
 	// remember: 0 -> button pressed (tied to GND), 1 -> button not pressed
@@ -9,13 +64,63 @@ uint8_t encoder_events(uint8_t oldstate, uint8_t newstate) {
 	if (((oldstate & ECST_STATEMASK_BUTTONSTATE) == 0) && ((newstate & ECST_STATEMASK_BUTTONSTATE) > 0))
 		retevent |= ECEV_BUTTON_UP;
 
-	if (((oldstate & ECST_STATEMASK_ENCODERSTATE) == ECST_EAST) &&
-		((newstate & ECST_STATEMASK_ENCODERSTATE) == ECST_SOUTH))
-		retevent |= ECEV_LEFT;
-	
-	if (((oldstate & ECST_STATEMASK_ENCODERSTATE) == ECST_WEST) &&
-		((newstate & ECST_STATEMASK_ENCODERSTATE) == ECST_SOUTH))
-		retevent |= ECEV_RIGHT;
+	uint8_t mask = detents(encoder);
+	uint8_t from = position[oldstate & ECST_STATEMASK_ENCODERSTATE];
+	uint8_t to = position[newstate & ECST_STATEMASK_ENCODERSTATE];
+
+	uint8_t extra = 0;
+	switch ((to - from) & 3) {
+		case 0: // idle
+			break;
+		case 1:
+			count(&encoder_stats[encoder].valid);
+			lastdir[encoder] = ECEV_LEFT;
+			if (IS_DETENT(mask, to)) retevent |= ECEV_LEFT;
+			break;
+		case 3:
+			count(&encoder_stats[encoder].valid);
+			lastdir[encoder] = ECEV_RIGHT;
+			if (IS_DETENT(mask, to)) retevent |= ECEV_RIGHT;
+			break;
+		case 2: { // illegal: skipped the state in between
+			count(&encoder_stats[encoder].illegal);
+			TRACE_TRIGGER(TRACE_CAUSE_ILLEGAL);
+			uint8_t skipped;
+			if (lastdir[encoder] == ECEV_LEFT)
+				skipped = (from + 1) & 3;
+			else if (lastdir[encoder] == ECEV_RIGHT)
+				skipped = (from - 1) & 3;
+			else
+				break; // no direction known yet, nothing to recover
+			if (IS_DETENT(mask, skipped) || IS_DETENT(mask, to)) {
+				count(&encoder_stats[encoder].recovered);
+				retevent |= lastdir[encoder];
+				// quarter step: two detents crossed at once
+				if (IS_DETENT(mask, skipped) && IS_DETENT(mask, to)) extra = 1;
+			}
+			break;
+		}
+	}
+
+	if (owedSteps[encoder] && !(retevent & owedDir[encoder])) {
+		uint8_t turned = retevent & (ECEV_LEFT | ECEV_RIGHT);
+		retevent = (retevent & ~turned) | owedDir[encoder];
+		owedSteps[encoder]--;
+		// turned back while a step was owed: that one goes out first and
+		// the step back is owed now, unless it only cancels another owed one
+		if (turned) {
+			if (owedSteps[encoder]) owedSteps[encoder]--;
+			else {
+				owedDir[encoder] = turned;
+				owedSteps[encoder] = 1;
+			}
+		}
+	}
+	if (extra) {
+		if (owedDir[encoder] != lastdir[encoder]) owedSteps[encoder] = 0;
+		owedDir[encoder] = lastdir[encoder];
+		owedSteps[encoder]++;
+	}
 
 	return retevent;
 }
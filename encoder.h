@@ -1,7 +1,8 @@
 #ifndef __encoder_h_included__
-#define encoder_h_included
+#define __encoder_h_included__
 
-typedef unsigned char uint8_t;
+#include <stdint.h>
+#include "numsticks.h"
 
 // elements of the ENCODER EVENT bitmask
 #define ECEV_NONE 0x00
@@ -10,6 +11,13 @@ typedef unsigned char uint8_t;
 #define ECEV_BUTTON_UP (1<<1)
 #define ECEV_LEFT (1<<2)
 #define ECEV_RIGHT (1<<3)
+// button gestures, added by the gesture engine (gesture.h)
+#define ECEV_SHORT_PRESS (1<<4)
+#define ECEV_LONG_PRESS (1<<5)
+#define ECEV_DOUBLE_CLICK (1<<6)
+#define ECEV_GESTURES (ECEV_SHORT_PRESS | ECEV_LONG_PRESS | ECEV_DOUBLE_CLICK)
+// number of event bits, one action per bit in the page tables
+#define ECEV_COUNT 7
 
 // encoder state
 #define ECST_STATEMASK_BUTTONSTATE  0b00000100
@@ -24,9 +32,44 @@ typedef unsigned char uint8_t;
 #define ECST_WEST  0b00000010
 
 #define ECST_DEFAULT_STATE ECST_NORTH
+// dial resting on a detent, button released
+#define ECST_RESTING_STATE (ECST_DEFAULT_STATE | ECST_STATEMASK_BUTTONSTATE)
 
+// every transition of the quadrature signal is one of
+// - idle:    no change
+// - valid:   a neighbouring state, one quarter cycle in either direction
+// - illegal: the opposite state, so one state was skipped (scan too slow
+//            or contact bounce). The decoder assumes the dial kept turning
+//            in the last known direction and emits the detent it crossed;
+//            with quarter steps it crossed two, the second one is emitted
+//            on the next call that does not step the same way already. A
+//            step back in that call waits for the next one, so no call
+//            reports both ECEV_LEFT and ECEV_RIGHT.
+typedef struct {
+	uint16_t valid;
+	uint16_t illegal;
+	uint16_t recovered;   // illegal transitions that crossed a detent
+} encoder_stats_t;
 
-uint8_t encoder_events(uint8_t oldstate, uint8_t newstate);
+// saturating counters, one set per encoder
+extern encoder_stats_t encoder_stats[NUMBER_OF_ENCODERS];
+
+uint8_t encoder_events(uint8_t encoder, uint8_t oldstate, uint8_t newstate);
+// forgets the last direction and any owed step of one encoder
+void encoder_reset(uint8_t encoder);
+void encoder_reset_stats(void);
+
+// bitmask of the positions along NORTH -> EAST -> SOUTH -> WEST (0..3) a
+// step is emitted on: full step stops at SOUTH, half step also at NORTH,
+// quarter step everywhere
+#define ENCODER_DETENT_MASK(resolution) \
+	((resolution) == 4 ? 0x0f : ((resolution) == 2 ? 0x05 : 0x04))
+
+#ifndef ENCODER_RESOLUTION
+// resolution: 1, 2 or 4 detents per quadrature cycle
+void encoder_set_resolution(uint8_t encoder, uint8_t resolution);
+uint8_t encoder_get_resolution(uint8_t encoder);
+#endif
 
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef __firmware_h_included__
+#define __firmware_h_included__
+
+// main() is firmware_init() followed by firmware_step() in a loop. A host
+// build (HAL_HOST) has its own main() and calls them directly, on the
+// device they are inlined into main().
+
+#ifdef HAL_HOST
+#define FIRMWARE_FUNCTION
+void firmware_init(void);
+void firmware_step(void);
+#else
+#define FIRMWARE_FUNCTION static inline __attribute__((always_inline))
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+#include "gesture.h"
+
+// buttons held down that have not been released or turned into a long press yet
+static gesture_mask_t held;
+// buttons released after a short press, waiting for a second press
+static gesture_mask_t waiting;
+// vertical counter: bit n of c0..c3 form the tick count of button n
+static gesture_mask_t c0, c1, c2, c3;
+
+void gesture_update(gesture_mask_t down, gesture_mask_t up, uint8_t tick, gestures_t *out) {
+	out->doubleclick = down & waiting;
+	waiting &= ~down;
+	// the second press of a double click does not become a long press
+	held = (held | down) & ~out->doubleclick;
+
+	waiting |= up & held;
+	held &= ~up;
+
+	// every edge restarts the time of its button
+	gesture_mask_t restart = ~(down | up);
+	c0 &= restart;
+	c1 &= restart;
+	c2 &= restart;
+	c3 &= restart;
+
+	if (tick) {
+		// increment all counters that are not saturated yet
+		gesture_mask_t carry = ~(c0 & c1 & c2 & c3);
+		c0 ^= carry; carry &= ~c0;
+		c1 ^= carry; carry &= ~c1;
+		c2 ^= carry; carry &= ~c2;
+		c3 ^= carry;
+	}
+
+	// counter == 15
+	out->longpress = held & c0 & c1 & c2 & c3;
+	held &= ~out->longpress;
+
+	// counter >= 8
+	out->shortpress = waiting & c3;
+	waiting &= ~out->shortpress;
+}
+
+void gesture_cancel(gesture_mask_t buttons) {
+	held &= ~buttons;
+	waiting &= ~buttons;
+}
@@ -0,0 +1,36 @@
+#ifndef __gesture_h_included__
+#define __gesture_h_included__
+
+#include <stdint.h>
+#include "numsticks.h"
+
+#if NUMBER_OF_ENCODERS > 16
+typedef uint32_t gesture_mask_t;
+#else
+typedef uint16_t gesture_mask_t;
+#endif
+
+// Press gestures for the buttons of all encoders, evaluated bit-parallel:
+// bit n of every mask belongs to button n, so one update costs the same no
+// matter how many buttons are pressed.
+//
+// Time is counted in gesture ticks by a 4 bit vertical counter per button.
+#define GESTURE_TICK_MS      32
+#define GESTURE_LONG_TICKS   15 // 480 ms held: long press (counter saturated)
+#define GESTURE_DOUBLE_TICKS 8  // 256 ms window for the second click
+
+// a short press is reported once the double click window has passed
+typedef struct {
+	gesture_mask_t shortpress;
+	gesture_mask_t longpress;
+	gesture_mask_t doubleclick;
+} gestures_t;
+
+// down/up: buttons pressed/released since the last call
+// tick:    nonzero if GESTURE_TICK_MS have passed since the last tick
+void gesture_update(gesture_mask_t down, gesture_mask_t up, uint8_t tick, gestures_t *out);
+
+// forget the press in progress, the buttons report nothing until pressed again
+void gesture_cancel(gesture_mask_t buttons);
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef __hal_h_included__
+#define __hal_h_included__
+
+// Hardware used by main.c: the 74HC165 chain on SPI, timer 0, the USB
+// interrupt endpoint and the watchdog. The displays are reached through
+// lcd-routines.h. On the device everything here is inline register code,
+// a host build (HAL_HOST) links host/hal-host.c and host/lcd-host.c
+// instead. HAL_SIM is the device build for the simulator (sim/).
+
+#include <stdint.h>
+#include "usbdrv.h"
+#include "numsticks.h"
+
+// bytes shifted in from the chain per scan
+#define HAL_CHAIN_BYTES CHAIN_BYTES
+
+#ifdef HAL_HOST
+
+void hal_init(void);
+void hal_usb_connect(void);
+void hal_enable_interrupts(void);
+void hal_wdt_reset(void);
+void hal_read_chain(uint8_t *chain);
+uint8_t hal_timer_count(void);
+uint8_t hal_timer_overflow(void);
+void hal_usb_poll(void);
+uint8_t hal_usb_ready(void);
+void hal_usb_send(uint8_t *data, uint8_t len);
+uint8_t hal_usb_frame(void);
+
+#else
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+static inline void hal_init(void) {
+	/**** SPI initialization ****/
+	// set PB2(/SS), PB3(MOSI), PB5(SCK) as output
+	DDRB    = (1<<PB2)|(1<<PB3)|(1<<PB5);
+	PORTB &= ~((1<<PB4)); // make sure MISO pull-up is disabled
+	PORTB &= ~(1<<PB2); // clear PARALLEL INPUT
+
+	TCCR0B = 5;      /* timer 0 prescaler: 1024 */
+}
+
+#ifdef HAL_SIM
+
+// simulation build (sim/): no USB, the interrupt endpoint is a mailbox
+// that the simulator watches. The payload goes to GPIOR0, its length to
+// GPIOR1 sends it, GPIOR2 is 1 while the endpoint is free. HAL_SIM_POLL
+// in GPIOR1 marks a usbPoll() call.
+#define HAL_SIM_POLL 0xff
+
+static inline void hal_usb_connect(void) {
+    wdt_enable(WDTO_2S);
+}
+
+static inline void hal_usb_poll(void) {
+	GPIOR1 = HAL_SIM_POLL;
+}
+
+static inline uint8_t hal_usb_ready(void) {
+	return GPIOR2;
+}
+
+static inline void hal_usb_send(uint8_t *data, uint8_t len) {
+	for (uint8_t i = 0; i < len; i++)
+		GPIOR0 = data[i];
+	GPIOR1 = len;
+}
+
+#else
+
+static inline void hal_usb_connect(void) {
+	uchar i;
+
+    usbInit();
+    usbDeviceDisconnect();  /* enforce re-enumeration, do this while interrupts are disabled! */
+    i = 0;
+    while(--i){             /* fake USB disconnect for > 250 ms */
+        wdt_reset();
+        _delay_ms(1);
+    }
+    usbDeviceConnect();
+
+    wdt_enable(WDTO_2S);
+}
+
+#endif
+
+static inline void hal_enable_interrupts(void) {
+	sei();
+}
+
+static inline void hal_wdt_reset(void) {
+	wdt_reset();
+}
+
+static inline uint8_t readByteSpi(void) {
+	// enable SPI in Master Mode with SCK = CK/128
+	SPCR    = (1<<SPE)|(1<<MSTR)|(1<<CPOL)|(1<<SPR0)|(1<<SPR1);
+	volatile char IOReg;
+	IOReg   = SPSR;                         // clear SPIF bit in SPSR
+	IOReg   = SPDR;
+
+	SPDR = 0x00; // shift out 8 bits (all zeroes here, nobody cares)
+		     // so 8 bits will be read back in
+        while (!(SPSR & (1<<SPIF)));
+	
+	return SPDR;
+}
+
+// latches the inputs and shifts the chain in
+static inline void hal_read_chain(uint8_t *chain) {
+	PORTB |= (1<<PB2); // set PARALLEL INPUT
+	_delay_us(1);
+
+	PORTB &= ~(1<<PB2); // clear PARALLEL INPUT
+	_delay_us(1);
+
+	for (uint8_t i = 0; i<HAL_CHAIN_BYTES; i++)
+		chain[i] = readByteSpi();
+}
+
+// timer 0, free running at CK/1024
+static inline uint8_t hal_timer_count(void) {
+	return TCNT0;
+}
+
+// 1 once per timer 0 overflow
+static inline uint8_t hal_timer_overflow(void) {
+	if (!(TIFR0 & (1<<TOV0))) return 0;
+	TIFR0 = 1<<TOV0;  /* clear overflow */
+	return 1;
+}
+
+#ifndef HAL_SIM
+static inline void hal_usb_poll(void) {
+	usbPoll();
+}
+
+static inline uint8_t hal_usb_ready(void) {
+	return usbInterruptIsReady();
+}
+
+static inline void hal_usb_send(uint8_t *data, uint8_t len) {
+	usbSetInterrupt(data, len);
+}
+#endif
+
+#if USB_COUNT_SOF
+static inline uint8_t hal_usb_frame(void) {
+	return usbSofCount;
+}
+#endif
+
+#endif
+
+#endif
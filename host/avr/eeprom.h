@@ -0,0 +1,16 @@
+// host build: EEPROM is an array in host/hal-host.c, addressed like the
+// device's (the pointers are EEPROM addresses)
+#ifndef __host_avr_eeprom_h__
+#define __host_avr_eeprom_h__
+
+#include <stdint.h>
+
+#define EEMEM
+
+uint8_t eeprom_read_byte(const uint8_t *p);
+uint16_t eeprom_read_word(const uint16_t *p);
+void eeprom_read_block(void *dst, const void *src, unsigned int n);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+int eeprom_is_ready(void);
+
+#endif
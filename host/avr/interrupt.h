@@ -0,0 +1,3 @@
+// host build: no interrupts
+#define sei()
+#define cli()
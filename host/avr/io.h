@@ -0,0 +1,18 @@
+// host build: the registers the firmware touches outside of hal.h
+#ifndef __host_avr_io_h__
+#define __host_avr_io_h__
+
+#include <stdint.h>
+
+#define E2END  0x1ff
+#define RAMEND 0x4ff
+
+// timer 1, used by the diagnostics (diag.h)
+extern volatile uint8_t TCCR1A, TCCR1B;
+uint16_t hal_host_timer1(void);
+#define TCNT1 hal_host_timer1()
+#define CS10 0
+#define CS11 1
+#define CS12 2
+
+#endif
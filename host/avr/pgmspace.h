@@ -0,0 +1,14 @@
+// host build: flash is ordinary memory
+#ifndef __host_avr_pgmspace_h__
+#define __host_avr_pgmspace_h__
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define memcpy_P memcpy
+
+#endif
@@ -0,0 +1,4 @@
+// host build: no watchdog
+#define wdt_reset()
+#define wdt_enable(timeout)
+#define WDTO_2S 7
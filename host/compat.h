@@ -0,0 +1,9 @@
+// host build: included into every file, declares what avr-libc has and
+// the host C library has not
+#ifndef __host_compat_h__
+#define __host_compat_h__
+
+char *utoa(unsigned int value, char *s, int radix);
+char *itoa(int value, char *s, int radix);
+
+#endif
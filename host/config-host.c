@@ -0,0 +1,43 @@
+// host build: config reports as the host tool sends them
+#include <string.h>
+#include <util/crc16.h>
+#include "config-host.h"
+#include "config.h"
+#include "numsticks.h"
+#include "profile.h"
+
+#define REPORT_ID_CONFIG (REPORT_ID_MAX + 1)
+
+uint8_t host_config_command(uint8_t cmd, uint8_t unit, uint8_t offset, uint8_t len, const void *data) {
+	uint8_t report[CONFIG_REPORT_SIZE] = { 0 };
+	uint8_t sum = 0;
+	report[0] = REPORT_ID_CONFIG;
+	report[1] = cmd;
+	report[2] = unit;
+	report[3] = offset;
+	report[4] = len;
+	if (len) memcpy(report + 5, data, len);
+	for (int i = 1; i < CONFIG_REPORT_SIZE - 1; i++) sum += report[i];
+	report[CONFIG_REPORT_SIZE - 1] = -sum;
+	config_begin();
+	config_write(report, CONFIG_REPORT_SIZE);
+	return config_report(REPORT_ID_CONFIG)[1];
+}
+
+uint8_t host_config_save(uint8_t unit, uint8_t offset, uint8_t len, const void *data) {
+	uint8_t staged[sizeof(profile_page_t)];
+	uint8_t size = profile_stage_size(unit);
+	uint8_t status = host_config_command(CFG_BEGIN, unit, 0, 0, NULL);
+	if (status != CFG_OK) return status;
+	status = host_config_command(CFG_WRITE, unit, offset, len, data);
+	if (status != CFG_OK) return status;
+	for (uint8_t pos = 0; pos < size; pos += CONFIG_DATA_SIZE) {
+		host_config_command(CFG_READ, unit, pos, 0, NULL);
+		uint8_t *report = config_report(REPORT_ID_CONFIG);
+		memcpy(staged + pos, report + 5, report[4]);
+	}
+	uint16_t crc = 0xffff;
+	for (uint8_t i = 0; i < size; i++) crc = _crc16_update(crc, staged[i]);
+	uint8_t crcBytes[2] = { crc & 0xff, crc >> 8 };
+	return host_config_command(CFG_COMMIT, unit, 0, 2, crcBytes);
+}
@@ -0,0 +1,17 @@
+#ifndef __config_host_h_included__
+#define __config_host_h_included__
+
+// The host tool's side of the config report (see config.h), for the
+// harnesses that change the profile like a user would.
+
+#include <stdint.h>
+
+// one SET_REPORT with a valid checksum, returns the status GET_REPORT reads
+uint8_t host_config_command(uint8_t cmd, uint8_t unit, uint8_t offset, uint8_t len, const void *data);
+
+// stages 'unit', writes len bytes at offset and commits them with the CRC
+// of the staged unit as read back. CFG_BUSY while an earlier save runs:
+// keep the firmware going and try again.
+uint8_t host_config_save(uint8_t unit, uint8_t offset, uint8_t len, const void *data);
+
+#endif
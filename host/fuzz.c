@@ -0,0 +1,323 @@
+// Decoder stress test on the host build. Turns a simulated dial with
+// plausible waveforms: every quarter step a little longer or shorter
+// (jitter), contacts chattering after an edge (bounce) and scans that
+// neither line up with the edges nor come at an exact period (aliasing).
+// The detents encoder_events() reports have to match the ones turned.
+// For each resolution, scan period and condition it prints the fastest
+// rotation that still decoded without a single error. Built with
+// ENCODER_RESOLUTIONS it runs full, half and quarter step dials, with a
+// fixed ENCODER_RESOLUTION only that one.
+//
+// Properties that fail the run (exit status 1):
+//  - clean waveforms with every quarter step at least two scans long
+//    decode exactly
+//  - firmware_step() unpacks every encoder from its bits of the chain: a
+//    legal step on one encoder counts as valid on that one only
+//  - no call of encoder_events() reports both directions, neither in the
+//    trials nor when a quarter step dial turns back right after skipping
+//    a state
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hal-host.h"
+#include "firmware.h"
+#include "numsticks.h"
+#include "encoder.h"
+
+#define DETENTS_PER_REV 24
+#define DETENTS 24           // each way per trial
+#define DWELL_SCANS 20       // at rest between the two directions
+#define MAX_CHATTER 3        // extra bounces per edge, each one two toggles
+
+typedef struct {
+	const char *name;
+	double jitter;       // quarter step length varies by up to this fraction
+	double scanJitter;   // scan period varies by up to this fraction
+	double bounceUs;     // chattering after an edge lasts up to this long
+} condition_t;
+
+static const condition_t conditions[] = {
+	{ "clean",  0,    0,    0 },
+	{ "jitter", 0.3,  0.1,  0 },
+	{ "bounce", 0,    0,    100 },
+	{ "both",   0.3,  0.1,  100 },
+};
+#define CONDITIONS (sizeof(conditions) / sizeof(conditions[0]))
+
+#ifdef ENCODER_RESOLUTION
+static const uint8_t resolutions[] = { ENCODER_RESOLUTION };
+#else
+static const uint8_t resolutions[] = { 1, 2, 4 };
+#endif
+#define RESOLUTIONS (sizeof(resolutions) / sizeof(resolutions[0]))
+static uint8_t resolution;   // of the trials running now
+static unsigned long bothWays;   // calls that reported left and right at once
+
+static const unsigned int scanPeriods[] = { 100, 200, 400, 800 };
+#define SCAN_PERIODS (sizeof(scanPeriods) / sizeof(scanPeriods[0]))
+
+// quarter steps turning right, see encoder.h: N W S E
+static const uint8_t quadrature[4] = { ECST_NORTH, ECST_WEST, ECST_SOUTH, ECST_EAST };
+
+static uint32_t seed = 1;
+
+static uint32_t xorshift(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+// uniform in [0, 1)
+static double uniform(void) {
+	return (xorshift() >> 8) / 16777216.0;
+}
+
+typedef struct {
+	double us;
+	uint8_t bit;      // ECST bit of the channel
+	uint8_t level;
+} edge_t;
+
+static edge_t *edges;
+static int edgeCount, edgeSize;
+
+static void addEdge(double us, uint8_t bit, uint8_t level) {
+	if (edgeCount == edgeSize) {
+		edgeSize = edgeSize ? 2 * edgeSize : 1024;
+		edges = realloc(edges, edgeSize * sizeof(edge_t));
+	}
+	edges[edgeCount].us = us;
+	edges[edgeCount].bit = bit;
+	edges[edgeCount++].level = level;
+}
+
+static int compareEdges(const void *a, const void *b) {
+	double x = ((const edge_t *)a)->us, y = ((const edge_t *)b)->us;
+	return x < y ? -1 : x > y;
+}
+
+// one channel changes per quarter step; with bounce it toggles back and
+// forth at random times in the bounce window and ends at the new level
+static void quarterStep(double us, uint8_t from, uint8_t to, double bounceUs) {
+	uint8_t bit = (from ^ to) & ECST_STATEMASK_ENCODERSTATE;
+	uint8_t level = (to & bit) != 0;
+	if (bounceUs <= 0) {
+		addEdge(us, bit, level);
+		return;
+	}
+	double window = uniform() * bounceUs;
+	int toggles = 1 + 2 * (xorshift() % (MAX_CHATTER + 1));
+	double times[1 + 2 * MAX_CHATTER];
+	times[0] = us;
+	for (int i = 1; i < toggles; i++) times[i] = us + uniform() * window;
+	for (int i = 1; i < toggles; i++)
+		for (int j = i + 1; j < toggles; j++)
+			if (times[j] < times[i]) { double t = times[i]; times[i] = times[j]; times[j] = t; }
+	for (int i = 0; i < toggles; i++) addEdge(times[i], bit, (i % 2 == 0) ? level : !level);
+}
+
+// DETENTS right, a pause, DETENTS left; returns 1 when both counts match
+static int trial(const condition_t *c, unsigned int scanUs, double rpm) {
+	double quarterUs = 60e6 / (rpm * DETENTS_PER_REV * 4);
+	double us = uniform() * scanUs;
+	uint8_t state = ECST_NORTH;
+	int steps = DETENTS * resolution;   // reported each way
+
+	// nothing left over from the last trial, lost or owed
+	encoder_reset(0);
+
+	edgeCount = 0;
+	double turnedRight = 0;
+	for (int step = 0; step < 8 * DETENTS; step++) {
+		if (step == 4 * DETENTS) {
+			turnedRight = us;
+			us += DWELL_SCANS * scanUs;
+		}
+		int right = step < 4 * DETENTS;
+		uint8_t next = quadrature[right ? (step + 1) % 4 : (4 - (step + 1) % 4) % 4];
+		quarterStep(us, state, next, c->bounceUs);
+		state = next;
+		us += quarterUs * (1 + c->jitter * (2 * uniform() - 1));
+	}
+	double end = us + c->bounceUs + DWELL_SCANS * scanUs;
+	qsort(edges, edgeCount, sizeof(edge_t), compareEdges);
+
+	uint8_t channels = ECST_NORTH | ECST_STATEMASK_BUTTONSTATE;
+	uint8_t old = channels;
+	int right = 0, left = 0, counted = 0;
+	int e = 0;
+	for (double t = 0; t < end; t += scanUs * (1 + c->scanJitter * (2 * uniform() - 1))) {
+		while (e < edgeCount && edges[e].us <= t) {
+			if (edges[e].level) channels |= edges[e].bit;
+			else channels &= ~edges[e].bit;
+			e++;
+		}
+		uint8_t events = encoder_events(0, old, channels);
+		old = channels;
+		if ((events & ECEV_LEFT) && (events & ECEV_RIGHT)) bothWays++;
+		if (events & ECEV_RIGHT) right++;
+		if (events & ECEV_LEFT) left++;
+		if (!counted && t > turnedRight + (DWELL_SCANS / 2) * scanUs) {
+			// the right half, settled in the pause
+			if (right != steps || left) return 0;
+			counted = 1;
+		}
+	}
+	return right == steps && left == steps;
+}
+
+static int levelPasses(const condition_t *c, unsigned int scanUs, double rpm, int trials) {
+	for (int i = 0; i < trials; i++)
+		if (!trial(c, scanUs, rpm)) return 0;
+	return 1;
+}
+
+// the fastest rpm where all trials decode, in 5% steps from 10rpm; 0 when
+// even slow turns go wrong now and then (bounce long enough for two scans)
+static double fastest(const condition_t *c, unsigned int scanUs, int trials) {
+	if (!levelPasses(c, scanUs, 10, 20 * trials)) return 0;
+	double rpm = 10, best = 0;
+	while (rpm < 100000 && levelPasses(c, scanUs, rpm, trials)) {
+		best = rpm;
+		rpm *= 1.05;
+	}
+	return best;
+}
+
+static int checkUnpacking(int trials) {
+	uint8_t states[NUMBER_OF_ENCODERS];
+	for (uint8_t i = 0; i < NUMBER_OF_ENCODERS; i++) states[i] = ECST_RESTING_STATE;
+	memset(hal_host_eeprom, 0xff, sizeof(hal_host_eeprom));
+	hal_host_set_encoders(states);
+	firmware_init();
+
+	for (int n = 0; n < trials; n++) {
+		// random resting positions first, then one legal quarter step
+		for (uint8_t i = 0; i < NUMBER_OF_ENCODERS; i++)
+			states[i] = quadrature[xorshift() % 4] | ECST_STATEMASK_BUTTONSTATE;
+		hal_host_set_encoders(states);
+		hal_host_advance_us(200);
+		firmware_step();
+		encoder_reset_stats();
+
+		uint8_t encoder = xorshift() % NUMBER_OF_ENCODERS;
+		int i;
+		for (i = 0; quadrature[i] != (states[encoder] & ECST_STATEMASK_ENCODERSTATE); i++);
+		states[encoder] = quadrature[(i + (xorshift() & 1 ? 1 : 3)) % 4] | ECST_STATEMASK_BUTTONSTATE;
+		hal_host_set_encoders(states);
+		hal_host_advance_us(200);
+		firmware_step();
+
+		for (uint8_t k = 0; k < NUMBER_OF_ENCODERS; k++) {
+			uint16_t expected = k == encoder;
+			if (encoder_stats[k].valid != expected || encoder_stats[k].illegal) {
+				printf("*** unpacking: step on encoder %u, encoder %u counted %u valid, %u illegal\n",
+					encoder, k, encoder_stats[k].valid, encoder_stats[k].illegal);
+				return 0;
+			}
+		}
+	}
+	printf("unpacking: %d single steps, each counted on its own encoder\n", trials);
+	return 1;
+}
+
+#ifndef ENCODER_RESOLUTION
+// quarter steps, from every state and both ways: one step, one state
+// skipped (two detents at once, the second one owed), one step back. The
+// owed step has to go out before the step back, each in a call of its own.
+static int checkReversal(void) {
+	// states along NORTH -> EAST -> SOUTH -> WEST, forward is ECEV_LEFT
+	static const uint8_t states[4] = { ECST_NORTH, ECST_EAST, ECST_SOUTH, ECST_WEST };
+	static const int8_t moves[] = { 1, 2, -1, 0, 0 };
+
+	encoder_set_resolution(0, 4);
+	for (uint8_t from = 0; from < 4; from++) {
+		for (int8_t dir = -1; dir <= 1; dir += 2) {
+			uint8_t forward = dir > 0 ? ECEV_LEFT : ECEV_RIGHT, back = forward ^ (ECEV_LEFT | ECEV_RIGHT);
+			int forwardSteps = 0, backSteps = 0;
+			uint8_t pos = from;
+			encoder_reset(0);
+			for (unsigned int i = 0; i < sizeof(moves); i++) {
+				uint8_t next = (pos + 4 + dir * moves[i]) & 3;
+				uint8_t events = encoder_events(0, states[pos] | ECST_STATEMASK_BUTTONSTATE,
+					states[next] | ECST_STATEMASK_BUTTONSTATE);
+				pos = next;
+				if ((events & forward) && (events & back)) {
+					printf("*** reversal: both directions in one call, move %u from state %u\n", i, from);
+					return 0;
+				}
+				forwardSteps += (events & forward) != 0;
+				backSteps += (events & back) != 0;
+			}
+			if (forwardSteps != 3 || backSteps != 1) {
+				printf("*** reversal: from state %u %d steps forward and %d back, expected 3 and 1\n",
+					from, forwardSteps, backSteps);
+				return 0;
+			}
+		}
+	}
+	printf("reversal: an owed quarter step goes out before the step back\n");
+	return 1;
+}
+#endif
+
+int main(int argc, char **argv) {
+	int trials = 50;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+			case 'n': trials = strtoul(optarg, NULL, 0); break;
+			case 's': seed = strtoul(optarg, NULL, 0) | 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-n trials per level] [-s seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	int ok = checkUnpacking(10 * trials);
+#ifndef ENCODER_RESOLUTION
+	ok &= checkReversal();
+#endif
+
+	printf("\nfastest rotation without errors, %d trials of %d detents each way per level,\n"
+		"%d detents per revolution:\n", trials, DETENTS, DETENTS_PER_REV);
+	for (unsigned int r = 0; r < RESOLUTIONS; r++) {
+		resolution = resolutions[r];
+#ifndef ENCODER_RESOLUTION
+		encoder_set_resolution(0, resolution);
+#endif
+		printf("resolution %u (detents per quadrature cycle):\n", resolution);
+		printf("%8s", "scan");
+		for (unsigned int c = 0; c < CONDITIONS; c++) printf(" %15s", conditions[c].name);
+		printf("\n");
+		for (unsigned int s = 0; s < SCAN_PERIODS; s++) {
+			unsigned int scanUs = scanPeriods[s];
+			printf("%6u us", scanUs);
+			for (unsigned int c = 0; c < CONDITIONS; c++) {
+				double rpm = fastest(&conditions[c], scanUs, trials);
+				if (rpm)
+					printf(" %5.0f rpm %4.0f/s", rpm, rpm * DETENTS_PER_REV / 60);
+				else
+					printf(" %15s", "errors at 10rpm");
+			}
+			printf("\n");
+
+			// two scans per quarter step have to be enough for clean waveforms
+			double safeRpm = 60e6 / (2.0 * scanUs * DETENTS_PER_REV * 4);
+			if (!levelPasses(&conditions[0], scanUs, safeRpm, trials)) {
+				printf("*** clean waveform at %.0f rpm (two scans per quarter step) lost steps\n", safeRpm);
+				ok = 0;
+			}
+		}
+	}
+	if (bothWays) {
+		printf("*** %lu calls reported both directions at once\n", bothWays);
+		ok = 0;
+	}
+	printf("conditions: jitter %.0f%% per quarter step and %.0f%% per scan, bounce up to %.0f us\n",
+		conditions[3].jitter * 100, conditions[3].scanJitter * 100, conditions[3].bounceUs);
+	return !ok;
+}
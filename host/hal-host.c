@@ -0,0 +1,157 @@
+#include <string.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include "hal-host.h"
+#include "numsticks.h"
+
+uint64_t hal_host_cycles;
+uint8_t hal_host_eeprom[HAL_HOST_EEPROM_SIZE];
+
+volatile uint8_t TCCR1A, TCCR1B;
+uchar *usbMsgPtr;
+
+static uint8_t chain[HAL_CHAIN_BYTES];
+static uint64_t lastOverflow;
+static uint64_t eepromBusyUntil;
+
+static hal_host_packet_fn onPacket;
+static uint8_t packet[8];
+static uint8_t packetLength;
+static uint8_t packetPending;
+static uint64_t nextPoll;
+
+#define CYCLES_PER_MS (HAL_HOST_F_CPU / 1000)
+#define EEPROM_WRITE_CYCLES (HAL_HOST_F_CPU / 1000 * 34 / 10) // 3.4ms
+
+void hal_host_advance_us(uint32_t us) {
+	hal_host_cycles += (uint64_t)us * (HAL_HOST_F_CPU / 1000000);
+}
+
+void hal_host_set_chain(const uint8_t *bytes) {
+	memcpy(chain, bytes, HAL_CHAIN_BYTES);
+}
+
+// three bits per encoder from ENCODER_CHAIN_BIT(n) on, see chain.h
+void hal_host_set_encoders(const uint8_t *states) {
+	uint8_t bytes[HAL_CHAIN_BYTES];
+	memset(bytes, 0, sizeof(bytes));
+	for (uint8_t n = 0; n < NUMBER_OF_ENCODERS; n++) {
+		for (uint8_t k = 0; k < 3; k++) {
+			uint8_t pos = ENCODER_CHAIN_BIT(n) + k;
+			if (states[n] & (4 >> k)) bytes[pos / 8] |= 0x80 >> (pos % 8);
+		}
+	}
+	hal_host_set_chain(bytes);
+}
+
+void hal_host_on_packet(hal_host_packet_fn fn) {
+	onPacket = fn;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void hal_init(void) {
+	lastOverflow = hal_host_cycles >> 18;
+}
+
+void hal_usb_connect(void) {
+	nextPoll = hal_host_cycles;
+}
+
+void hal_enable_interrupts(void) {
+}
+
+void hal_wdt_reset(void) {
+}
+
+void hal_read_chain(uint8_t *bytes) {
+	memcpy(bytes, chain, HAL_CHAIN_BYTES);
+}
+
+uint8_t hal_timer_count(void) {
+	return hal_host_cycles >> 10;
+}
+
+uint8_t hal_timer_overflow(void) {
+	uint64_t overflow = hal_host_cycles >> 18;
+	if (overflow == lastOverflow) return 0;
+	lastOverflow = overflow;
+	return 1;
+}
+
+uint16_t hal_host_timer1(void) {
+	return hal_host_cycles >> 6;
+}
+
+// the host picks up a pending packet once per polling interval
+void hal_usb_poll(void) {
+	if (!packetPending || hal_host_cycles < nextPoll) return;
+	packetPending = 0;
+	if (onPacket) onPacket(packet, packetLength);
+	nextPoll = hal_host_cycles + USB_CFG_INTR_POLL_INTERVAL * CYCLES_PER_MS;
+}
+
+uint8_t hal_usb_ready(void) {
+	return !packetPending;
+}
+
+void hal_usb_send(uint8_t *data, uint8_t len) {
+	memcpy(packet, data, len);
+	packetLength = len;
+	packetPending = 1;
+}
+
+uint8_t hal_usb_frame(void) {
+	return hal_host_cycles / CYCLES_PER_MS;
+}
+
+/* ------------------------------------------------------------------------- */
+
+uint8_t eeprom_read_byte(const uint8_t *p) {
+	return hal_host_eeprom[(uintptr_t)p % HAL_HOST_EEPROM_SIZE];
+}
+
+uint16_t eeprom_read_word(const uint16_t *p) {
+	const uint8_t *b = (const uint8_t *)p;
+	return eeprom_read_byte(b) | (eeprom_read_byte(b + 1) << 8);
+}
+
+void eeprom_read_block(void *dst, const void *src, unsigned int n) {
+	for (unsigned int i = 0; i < n; i++)
+		((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value) {
+	hal_host_eeprom[(uintptr_t)p % HAL_HOST_EEPROM_SIZE] = value;
+	eepromBusyUntil = hal_host_cycles + EEPROM_WRITE_CYCLES;
+}
+
+int eeprom_is_ready(void) {
+	return hal_host_cycles >= eepromBusyUntil;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static char *toString(unsigned long value, char *s, int radix, int negative) {
+	char digits[34];
+	int n = 0;
+	do {
+		digits[n++] = "0123456789abcdefghijklmnopqrstuvwxyz"[value % radix];
+		value /= radix;
+	} while (value);
+	char *p = s;
+	if (negative) *p++ = '-';
+	while (n) *p++ = digits[--n];
+	*p = 0;
+	return s;
+}
+
+char *utoa(unsigned int value, char *s, int radix) {
+	return toString(value, s, radix, 0);
+}
+
+char *itoa(int value, char *s, int radix) {
+	if (value < 0 && radix == 10) return toString(-(long)value, s, radix, 1);
+	return toString((unsigned int)value, s, radix, 0);
+}
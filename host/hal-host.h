@@ -0,0 +1,31 @@
+#ifndef __hal_host_h_included__
+#define __hal_host_h_included__
+
+// Control side of the host HAL: simulated time, the inputs on the chain,
+// what the firmware sends and shows. Time only moves when the harness
+// advances it.
+
+#include <stdint.h>
+#include "hal.h"
+
+#define HAL_HOST_F_CPU 20000000UL
+#define HAL_HOST_EEPROM_SIZE 512
+#define HAL_HOST_LCD_COLUMNS 20
+
+extern uint64_t hal_host_cycles;
+extern uint8_t hal_host_eeprom[HAL_HOST_EEPROM_SIZE];
+
+void hal_host_advance_us(uint32_t us);
+
+// raw chain bytes, or the 3 bit states of NUMBER_OF_ENCODERS encoders
+void hal_host_set_chain(const uint8_t *chain);
+void hal_host_set_encoders(const uint8_t *states);
+
+// interrupt packets as the host takes them, every USB_CFG_INTR_POLL_INTERVAL ms
+typedef void (*hal_host_packet_fn)(const uint8_t *data, uint8_t len);
+void hal_host_on_packet(hal_host_packet_fn fn);
+
+// text of a display row (display and row from 1), 20 characters
+void hal_host_lcd_row(uint8_t display, uint8_t row, char *text);
+
+#endif
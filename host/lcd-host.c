@@ -0,0 +1,75 @@
+// host build: the two HD44780 displays as DDRAM arrays
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "lcd-routines.h"
+#include "hal-host.h"
+
+#define DDRAM_SIZE 0x80
+
+static uint8_t ddram[2][DDRAM_SIZE];
+static uint8_t address[2];
+static uint8_t selected;
+
+void lcd_select(uint8_t lcd_number) {
+	selected = lcd_number == 2 ? 1 : 0;
+}
+
+void lcd_init(void) {
+	lcd_clear();
+}
+
+void lcd_clear(void) {
+	memset(ddram[selected], ' ', DDRAM_SIZE);
+	address[selected] = 0;
+}
+
+void lcd_home(void) {
+	address[selected] = 0;
+}
+
+void lcd_setcursor(uint8_t spalte, uint8_t zeile) {
+	static const uint8_t line[4] = { LCD_DDADR_LINE1, LCD_DDADR_LINE2, LCD_DDADR_LINE3, LCD_DDADR_LINE4 };
+	if (zeile < 1 || zeile > 4) return;
+	address[selected] = (line[zeile - 1] + spalte) & (DDRAM_SIZE - 1);
+}
+
+void lcd_data(uint8_t data) {
+	ddram[selected][address[selected]] = data;
+	address[selected] = (address[selected] + 1) & (DDRAM_SIZE - 1);
+}
+
+void lcd_string(const char *data) {
+	while (*data) lcd_data(*data++);
+}
+
+void lcd_num(uint8_t number) {
+	char text[4];
+	lcd_string(utoa(number, text, 10));
+}
+
+void lcd_bit(uint8_t truth) {
+	lcd_data(truth ? '1' : '0');
+}
+
+void lcd_byte(uint8_t byte) {
+	for (uint8_t mask = 0x80; mask; mask >>= 1) lcd_bit(byte & mask);
+}
+
+void lcd_generatechar(uint8_t code, const uint8_t *data) {
+}
+
+void lcd_command(uint8_t data) {
+	if (data & LCD_SET_DDADR)
+		address[selected] = data & (DDRAM_SIZE - 1);
+	else if (data == LCD_CLEAR_DISPLAY)
+		lcd_clear();
+	else if ((data & ~1) == LCD_CURSOR_HOME)
+		lcd_home();
+}
+
+void hal_host_lcd_row(uint8_t display, uint8_t row, char *text) {
+	uint8_t start = row == 2 ? LCD_DDADR_LINE2 : LCD_DDADR_LINE1;
+	memcpy(text, &ddram[display == 2 ? 1 : 0][start], HAL_HOST_LCD_COLUMNS);
+	text[HAL_HOST_LCD_COLUMNS] = 0;
+}
@@ -0,0 +1,295 @@
+// Golden trace harness: replays a recording through the host build and
+// compares the reports it sends and the display contents with a golden
+// file next to it (foo.rec -> foo.golden). -u writes the golden file.
+//
+// Recordings use the sim script format (see sim/sim.c), times in ms
+// since reset, fractions allowed:
+//   <ms> chain <b0> <b1> <b2> <b3>    raw chain snapshot, CHAIN_BYTES of them
+//   <ms> enc <encoder> <state>        one encoder, the rest unchanged
+//   <ms> end                          stop
+// and, for host/replay only, a profile change through the config report:
+//   <ms> bind <page> <dial> <kind> <button> <step> [<gestures>]
+// dial counts from 0, the rest as in binding_t (see profile.h).
+// -T converts a GET_TRACE reply saved to a file into a recording of its
+// snapshots, so sessions on the real panel can be replayed.
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hal-host.h"
+#include "config-host.h"
+#include "firmware.h"
+#include "numsticks.h"
+#include "encoder.h"
+#include "trace.h"
+#include "chain.h"
+#include "config.h"
+#include "profile.h"
+
+#define SETTLE_MS 500 // after the last step: releases and the last reports
+#define MAX_DIFFS 10
+// numbers on a line: a chain snapshot or a bind
+#define MAX_VALUES (HAL_CHAIN_BYTES > 6 ? HAL_CHAIN_BYTES : 6)
+
+static FILE *out;
+
+static double nowMs(void) {
+	return hal_host_cycles / (HAL_HOST_F_CPU / 1000.0);
+}
+
+static void packet(const uint8_t *data, uint8_t len) {
+	fprintf(out, "%10.3f report", nowMs());
+	for (uint8_t i = 0; i < len; i++) fprintf(out, " %02x", data[i]);
+	fprintf(out, "\n");
+}
+
+static char screens[2][2][HAL_HOST_LCD_COLUMNS + 1];
+
+static void checkScreens(void) {
+	char text[HAL_HOST_LCD_COLUMNS + 1];
+	for (uint8_t display = 0; display < 2; display++) {
+		for (uint8_t row = 0; row < 2; row++) {
+			hal_host_lcd_row(display + 1, row + 1, text);
+			if (!strcmp(text, screens[display][row])) continue;
+			strcpy(screens[display][row], text);
+			fprintf(out, "%10.3f lcd%u.%u |%s|\n", nowMs(), display + 1, row + 1, text);
+		}
+	}
+}
+
+// numbers after the keyword, -1 if there are more than max
+static int readValues(const char *text, unsigned int *v, int max) {
+	int n = 0;
+	for (;;) {
+		char *end;
+		unsigned long value = strtoul(text, &end, 0);
+		if (end == text) return n;
+		if (n == max) return -1;
+		v[n++] = value;
+		text = end;
+	}
+}
+
+// page, dial, kind, button, step and gestures: saves the binding like the
+// host tool would, the scans go on while an earlier save is being written
+static int bind(const unsigned int *v, unsigned int scanUs) {
+	binding_t binding = { v[2], v[3], { v[4] & 0xff, v[4] >> 8 }, v[5] };
+	uint8_t status;
+	while ((status = host_config_save(v[0], offsetof(profile_page_t, bindings[v[1]]),
+			sizeof(binding), &binding)) == CFG_BUSY) {
+		hal_host_advance_us(scanUs);
+		firmware_step();
+		checkScreens();
+	}
+	return status == CFG_OK;
+}
+
+static int replay(const char *name, unsigned int scanUs) {
+	FILE *f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		return 0;
+	}
+
+	uint8_t states[NUMBER_OF_ENCODERS];
+	for (uint8_t i = 0; i < NUMBER_OF_ENCODERS; i++) states[i] = ECST_RESTING_STATE;
+	memset(hal_host_eeprom, 0xff, sizeof(hal_host_eeprom));
+	hal_host_on_packet(packet);
+	hal_host_set_encoders(states);
+	firmware_init();
+
+	char line[256];
+	int lineNumber = 0;
+	double lastMs = 0;
+	int ended = 0;
+	while (!ended && fgets(line, sizeof(line), f)) {
+		lineNumber++;
+		char *comment = strchr(line, '#');
+		if (comment) *comment = 0;
+		char word[16];
+		double ms;
+		unsigned int v[MAX_VALUES];
+		int pos;
+		if (sscanf(line, "%15s", word) <= 0) continue;
+		int n = sscanf(line, "%lf %15s%n", &ms, word, &pos) == 2 ? readValues(line + pos, v, MAX_VALUES) : -1;
+		if (n < 0 || ms < lastMs) {
+			fprintf(stderr, "%s:%d: bad line\n", name, lineNumber);
+			fclose(f);
+			return 0;
+		}
+		while (nowMs() + scanUs / 1000.0 <= ms) {
+			hal_host_advance_us(scanUs);
+			firmware_step();
+			checkScreens();
+		}
+		lastMs = ms;
+		if (n == HAL_CHAIN_BYTES && !strcmp(word, "chain")) {
+			uint8_t chain[HAL_CHAIN_BYTES];
+			for (int i = 0; i < HAL_CHAIN_BYTES; i++) chain[i] = v[i];
+			hal_host_set_chain(chain);
+			chain_unpack(chain, states);
+			for (uint8_t i = 0; i < NUMBER_OF_ENCODERS; i++) states[i] &= 7;
+		} else if (n == 2 && !strcmp(word, "enc") && v[0] < NUMBER_OF_ENCODERS) {
+			states[v[0]] = v[1];
+			hal_host_set_encoders(states);
+		} else if ((n == 5 || n == 6) && !strcmp(word, "bind") && v[1] < NUMBER_OF_DIALS) {
+			if (n == 5) v[5] = 0;
+			if (!bind(v, scanUs)) {
+				fprintf(stderr, "%s:%d: binding refused\n", name, lineNumber);
+				fclose(f);
+				return 0;
+			}
+		} else if (n == 0 && !strcmp(word, "end")) {
+			ended = 1;
+		} else {
+			fprintf(stderr, "%s:%d: bad line\n", name, lineNumber);
+			fclose(f);
+			return 0;
+		}
+	}
+	fclose(f);
+
+	if (!ended) {
+		while (nowMs() < lastMs + SETTLE_MS) {
+			hal_host_advance_us(scanUs);
+			firmware_step();
+			checkScreens();
+		}
+	}
+	return 1;
+}
+
+// first differing lines, 1 when both are the same
+static int compare(const char *golden, const char *output, size_t size) {
+	FILE *g = fopen(golden, "r");
+	if (!g) {
+		fprintf(stderr, "%s: no golden file, write it with -u\n", golden);
+		return 0;
+	}
+	FILE *o = fmemopen((void *)output, size, "r");
+	char a[256], b[256];
+	int lineNumber = 0, diffs = 0;
+	for (;;) {
+		char *ga = fgets(a, sizeof(a), g);
+		char *ob = fgets(b, sizeof(b), o);
+		if (!ga && !ob) break;
+		lineNumber++;
+		if (ga && ob && !strcmp(a, b)) continue;
+		if (diffs++ < MAX_DIFFS) {
+			fprintf(stderr, "%s:%d:\n", golden, lineNumber);
+			if (ga) fprintf(stderr, "- %s", a);
+			if (ob) fprintf(stderr, "+ %s", b);
+		}
+	}
+	if (diffs > MAX_DIFFS) fprintf(stderr, "%s: %d more lines differ\n", golden, diffs - MAX_DIFFS);
+	fclose(g);
+	fclose(o);
+	return !diffs;
+}
+
+static void printChain(unsigned long ms, const uint8_t *chain) {
+	printf("%lu chain", ms);
+	for (uint8_t i = 0; i < TRACE_CHAIN_BYTES; i++) printf(" 0x%02x", chain[i]);
+	printf("\n");
+}
+
+// GET_TRACE reply: TRACE_HEADER_SIZE bytes of trace_header_t, field by
+// field little endian, and the records
+static int convertTrace(const char *name) {
+	FILE *f = fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		return 0;
+	}
+	uint8_t data[4096];
+	size_t size = fread(data, 1, sizeof(data), f);
+	fclose(f);
+	if (size < TRACE_HEADER_SIZE) {
+		fprintf(stderr, "%s: too short for a trace\n", name);
+		return 0;
+	}
+
+	static const uint8_t payloadSize[8] = { 1, 2, 1, 1, 1, 0, 0, 0 };
+	uint16_t length = data[2] | data[3] << 8;
+	unsigned long ms = data[4] | data[5] << 8;
+	uint8_t chain[TRACE_CHAIN_BYTES];
+	memcpy(chain, data + TRACE_HEADER_SIZE - TRACE_CHAIN_BYTES, TRACE_CHAIN_BYTES);
+	size_t end = TRACE_HEADER_SIZE + length;
+	if (end > size) end = size;
+
+	// times relative to the base, after a second for the boot
+	unsigned long start = ms;
+	printf("# converted from %s\n", name);
+	printChain(1000, chain);
+	for (size_t pos = TRACE_HEADER_SIZE; pos < end; ) {
+		uint8_t h = data[pos++];
+		uint8_t type = h >> 5;
+		unsigned int delta = h & 0x1f;
+		if (delta == 31 && pos < end) delta += data[pos++];
+		ms += delta;
+		if (type != TRACE_REC_SNAPSHOT) {
+			pos += payloadSize[type];
+			continue;
+		}
+		if (pos >= end) break; // cut off before its mask
+		uint8_t mask = data[pos++];
+		for (uint8_t i = 0; i < TRACE_CHAIN_BYTES; i++)
+			if ((mask & (1 << i)) && pos < end) chain[i] = data[pos++];
+		printChain(1000 + ms - start, chain);
+	}
+	printf("%lu end\n", 1000 + ms - start + SETTLE_MS);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	unsigned int scanUs = 200;
+	int update = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:uT:")) != -1) {
+		switch (opt) {
+			case 't': scanUs = strtoul(optarg, NULL, 0); break;
+			case 'u': update = 1; break;
+			case 'T': return !convertTrace(optarg);
+			default:
+				fprintf(stderr, "usage: %s [-t us per scan] [-u] recording.rec\n"
+					"       %s -T trace.bin > recording.rec\n", argv[0], argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "%s: no recording\n", argv[0]);
+		return 1;
+	}
+
+	const char *name = argv[optind];
+	char golden[256];
+	snprintf(golden, sizeof(golden), "%.*s.golden",
+		(int)(strrchr(name, '.') ? strrchr(name, '.') - name : (long)strlen(name)), name);
+
+	char *output;
+	size_t size;
+	out = open_memstream(&output, &size);
+	fprintf(out, "# %s, %u us per scan\n", name, scanUs);
+	if (!replay(name, scanUs)) return 1;
+	fclose(out);
+
+	if (update) {
+		FILE *g = fopen(golden, "w");
+		if (!g) {
+			perror(golden);
+			return 1;
+		}
+		fwrite(output, 1, size, g);
+		fclose(g);
+		printf("%s written\n", golden);
+		return 0;
+	}
+	if (!compare(golden, output, size)) {
+		printf("%s: FAILED\n", name);
+		return 1;
+	}
+	printf("%s: ok, %.1f s replayed\n", name, nowMs() / 1000);
+	return 0;
+}
@@ -0,0 +1,76 @@
+// host build driver: runs the firmware against a synthetic panel, turning
+// the dials one after the other, and reports the throughput
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "hal-host.h"
+#include "firmware.h"
+#include "numsticks.h"
+#include "encoder.h"
+
+static unsigned long packets;
+static int verbose;
+
+static void packet(const uint8_t *data, uint8_t len) {
+	packets++;
+	if (!verbose) return;
+	printf("%10.3f ms:", hal_host_cycles / (HAL_HOST_F_CPU / 1000.0));
+	for (uint8_t i = 0; i < len; i++) printf(" %02x", data[i]);
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	unsigned long scans = 1000000;
+	unsigned int scanUs = 200;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:v")) != -1) {
+		switch (opt) {
+			case 'n': scans = strtoul(optarg, NULL, 0); break;
+			case 't': scanUs = strtoul(optarg, NULL, 0); break;
+			case 'v': verbose = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-n scans] [-t us per scan] [-v]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	static const uint8_t quadrature[4] = { ECST_NORTH, ECST_EAST, ECST_SOUTH, ECST_WEST };
+	uint8_t states[NUMBER_OF_ENCODERS];
+	for (uint8_t i = 0; i < NUMBER_OF_ENCODERS; i++) states[i] = ECST_RESTING_STATE;
+
+	memset(hal_host_eeprom, 0xff, sizeof(hal_host_eeprom));
+	hal_host_on_packet(packet);
+	hal_host_set_encoders(states);
+	firmware_init();
+
+	clock_t start = clock();
+	for (unsigned long n = 0; n < scans; n++) {
+		// a quarter step every 10 scans, 32 detents one way and back per dial
+		if (n % 10 == 0) {
+			unsigned long step = n / 10;
+			uint8_t dial = (step / 256) % NUMBER_OF_DIALS;
+			uint8_t phase = (step / 128) % 2 ? (4 - step % 4) % 4 : step % 4;
+			states[dial] = quadrature[phase] | ECST_STATEMASK_BUTTONSTATE;
+			hal_host_set_encoders(states);
+		}
+		hal_host_advance_us(scanUs);
+		firmware_step();
+	}
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	char text[HAL_HOST_LCD_COLUMNS + 1];
+	for (uint8_t display = 1; display <= 2; display++) {
+		for (uint8_t row = 1; row <= 2; row++) {
+			hal_host_lcd_row(display, row, text);
+			printf("LCD%u |%s|\n", display, text);
+		}
+	}
+	printf("%lu scans, %.1f s simulated, %lu packets\n", scans,
+		hal_host_cycles / (double)HAL_HOST_F_CPU, packets);
+	if (seconds > 0)
+		printf("%.0f scans/s on this host\n", scans / seconds);
+	return 0;
+}
@@ -0,0 +1,163 @@
+// Power loss test of the profile slots on the host build. Pages and the
+// settings are saved through the config report like the host tool does
+// it, the power is cut at every point of a save and the firmware boots
+// again from what the EEPROM holds by then.
+//
+// Properties that fail the run (exit status 1):
+//  - after a cut, the unit being saved is either the old or the new save,
+//    never the defaults, and the other units keep theirs
+//  - a completed save survives a reboot
+//  - a slot whose CRC does not match is skipped for the previous save
+//  - the newest save still wins after the sequence numbers wrap around
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "hal-host.h"
+#include "config-host.h"
+#include "firmware.h"
+#include "config.h"
+#include "profile.h"
+#include "storage.h"
+
+#if PROFILE_PAGES < 2
+#error "the test saves two pages"
+#endif
+
+#define SCAN_US 200
+#define CUT_STEP_SCANS 3     // cut points this far apart, a byte takes ~17
+#define SAVE_SCANS 20000     // long enough for any save to complete
+
+static int failures;
+
+static void run(int scans) {
+	for (int i = 0; i < scans; i++) {
+		hal_host_advance_us(SCAN_US);
+		firmware_step();
+	}
+}
+
+static uint8_t save(uint8_t unit, uint8_t offset, uint8_t len, const void *data) {
+	uint8_t status;
+	while ((status = host_config_save(unit, offset, len, data)) == CFG_BUSY) run(1);
+	return status;
+}
+
+static uint8_t saveTitle(uint8_t page, const char *title) {
+	char text[PROFILE_TITLE_LENGTH] = { 0 };
+	memcpy(text, title, strlen(title) < PROFILE_TITLE_LENGTH ? strlen(title) : PROFILE_TITLE_LENGTH);
+	return save(page, offsetof(profile_page_t, title), PROFILE_TITLE_LENGTH, text);
+}
+
+static uint8_t saveReleaseDelay(uint8_t delay) {
+	return save(0, offsetof(profile_settings_t, releaseDelay), 1, &delay);
+}
+
+static void expectTitle(const char *when, uint8_t page, const char *old, const char *new) {
+	char text[PROFILE_TITLE_LENGTH + 1];
+	profile_title(page, text);
+	if (strcmp(text, old) && (!new || strcmp(text, new))) {
+		printf("FAIL %s: page %u shows \"%s\", expected \"%s\"%s%s%s\n", when, page, text,
+			old, new ? " or \"" : "", new ? new : "", new ? "\"" : "");
+		failures++;
+	}
+}
+
+// cuts the power a little later each time while 'unit' is being saved,
+// 0 saves the release delay, pages their title
+static void cutDuringSave(uint8_t unit) {
+	static uint8_t image[HAL_HOST_EEPROM_SIZE];
+	char when[48];
+	int cut, complete = 0;
+
+	memcpy(image, hal_host_eeprom, sizeof(image));
+	for (cut = 0; !complete; cut += CUT_STEP_SCANS) {
+		memcpy(hal_host_eeprom, image, sizeof(image));
+		firmware_init();
+		if ((unit ? saveTitle(unit, "New") : saveReleaseDelay(7)) != CFG_OK) {
+			printf("FAIL save of unit %u refused\n", unit);
+			failures++;
+			return;
+		}
+		run(cut);
+		complete = !storage_busy();
+		firmware_init(); // power cut: the queue is gone, the EEPROM stays
+
+		snprintf(when, sizeof(when), "unit %u cut after %d scans", unit, cut);
+		if (unit) {
+			expectTitle(when, unit, "Old", "New");
+			expectTitle(when, 3 - unit, "Other", NULL);
+		} else if (profile_settings.releaseDelay != 5 && profile_settings.releaseDelay != 7) {
+			printf("FAIL %s: release delay %u\n", when, profile_settings.releaseDelay);
+			failures++;
+		}
+		if (complete) {
+			if (unit) expectTitle(when, unit, "New", NULL);
+			else if (profile_settings.releaseDelay != 7) {
+				printf("FAIL %s: complete save lost\n", when);
+				failures++;
+			}
+		}
+	}
+	printf("unit %u: %d cut points up to a complete save\n", unit, cut / CUT_STEP_SCANS);
+}
+
+// corrupts the newest slot of page 1, the save before it shows again
+static void badCrc(void) {
+	saveTitle(1, "Before");
+	run(SAVE_SCANS);
+	saveTitle(1, "After");
+	run(SAVE_SCANS);
+	firmware_init();
+	expectTitle("two saves", 1, "After", NULL);
+
+	for (uint8_t slot = 0; slot < PROFILE_PAGES + 1; slot++) {
+		profile_page_slot_t *s = &((profile_eeprom_t *)(hal_host_eeprom + PROFILE_EEPROM_ADDRESS))->pages[slot];
+		if (s->unit == 1 && !strcmp(s->page.title, "After")) s->page.title[0] ^= 0x20;
+	}
+	firmware_init();
+	expectTitle("bad CRC", 1, "Before", NULL);
+}
+
+static void wrap(void) {
+	char title[PROFILE_TITLE_LENGTH + 1];
+	for (int i = 0; i < 600; i++) {
+		snprintf(title, sizeof(title), "Save %d", i);
+		saveTitle(1 + i % 2, title);
+		run(SAVE_SCANS / 4);
+	}
+	run(SAVE_SCANS);
+	firmware_init();
+	expectTitle("after 600 saves", 1, "Save 598", NULL);
+	expectTitle("after 600 saves", 2, "Save 599", NULL);
+}
+
+int main(void) {
+	memset(hal_host_eeprom, 0xff, sizeof(hal_host_eeprom));
+	firmware_init();
+	run(100);
+	saveTitle(1, "Old");
+	run(SAVE_SCANS);
+	saveTitle(2, "Other");
+	run(SAVE_SCANS);
+	saveReleaseDelay(5);
+	run(SAVE_SCANS);
+	firmware_init();
+	expectTitle("first saves", 1, "Old", NULL);
+	expectTitle("first saves", 2, "Other", NULL);
+
+	cutDuringSave(1);
+	// page 2 next, with page 1 as the one that has to stay
+	saveTitle(1, "Old");
+	run(SAVE_SCANS);
+	saveTitle(2, "Old");
+	run(SAVE_SCANS);
+	saveTitle(1, "Other");
+	run(SAVE_SCANS);
+	cutDuringSave(2);
+	cutDuringSave(0);
+	badCrc();
+	wrap();
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,14 @@
+// host build: the avr-libc CRC in plain C
+#ifndef __host_util_crc16_h__
+#define __host_util_crc16_h__
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a) {
+	crc ^= a;
+	for (uint8_t i = 0; i < 8; i++)
+		crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : (crc >> 1);
+	return crc;
+}
+
+#endif
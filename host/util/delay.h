@@ -0,0 +1,3 @@
+// host build: delays take no time
+#define _delay_us(us)
+#define _delay_ms(ms)
@@ -0,0 +1,53 @@
+#include <string.h>
+#include "latency.h"
+
+#if DIAG_LATENCY
+
+diag_hist_t latency_stats;
+
+static uint16_t scanTicks;
+static uint16_t scanMs;
+
+typedef struct {
+	uint8_t pending;
+	uint16_t ticks;
+	uint16_t ms;
+} stamp_t;
+static stamp_t stamps[REPORT_ID_MAX];
+
+void latency_reset(void) {
+	diag_hist_reset(&latency_stats, 1);
+}
+
+void latency_init(void) {
+	diag_timer_init();
+	latency_reset();
+}
+
+void latency_scan(uint16_t ms) {
+	scanTicks = DIAG_TICKS();
+	scanMs = ms;
+}
+
+void latency_events(uint8_t *changed) {
+	for (uint8_t i=0; i<REPORT_ID_MAX; i++) {
+		if ((changed[i >> 3] & (1 << (i & 7))) && !stamps[i].pending) {
+			stamps[i].pending = 1;
+			stamps[i].ticks = scanTicks;
+			stamps[i].ms = scanMs;
+		}
+	}
+	memset(changed, 0, (REPORT_ID_MAX + 7) / 8);
+}
+
+void latency_sent(uint8_t report, uint16_t ms) {
+	stamp_t *stamp = &stamps[report];
+	if (!stamp->pending) return;
+	stamp->pending = 0;
+	if ((uint16_t)(ms - stamp->ms) >= 200)
+		diag_hist_add(&latency_stats, 0xffff);
+	else
+		diag_hist_add(&latency_stats, DIAG_TICKS() - stamp->ticks);
+}
+
+#endif
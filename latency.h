@@ -0,0 +1,41 @@
+#ifndef __latency_h_included__
+#define __latency_h_included__
+
+#include <stdint.h>
+#include "numsticks.h"
+#include "diag.h"
+
+// Event to report latency: every report changed by an input event is stamped
+// with the time of the shift register snapshot, and the delay until its
+// first packet is handed to usbSetInterrupt() goes into latency_stats
+// (GET_STATS section DIAG_LATENCY_STATS). A report that was already
+// waiting keeps the stamp of its first event. Timer1 wraps after 210ms,
+// longer delays are recorded as 0xffff.
+
+#if DIAG_LATENCY
+
+extern diag_hist_t latency_stats;
+
+void latency_init(void);
+void latency_reset(void);
+// at the shift register snapshot
+void latency_scan(uint16_t ms);
+// after the events are handled, with the bitmap of the reports input
+// events changed (not the ones only a tap release made dirty); clears it
+void latency_events(uint8_t *changed);
+// when the first packet of report index (0..REPORT_ID_MAX-1) is sent
+void latency_sent(uint8_t report, uint16_t ms);
+
+#define LATENCY_SCAN(ms)           latency_scan(ms)
+#define LATENCY_EVENTS(changed)    latency_events(changed)
+#define LATENCY_SENT(report, ms)   latency_sent(report, ms)
+
+#else
+
+#define LATENCY_SCAN(ms)
+#define LATENCY_EVENTS(changed)
+#define LATENCY_SENT(report, ms)
+
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+#include <string.h>
+#include "lcd-buffer.h"
+#include "lcd-routines.h"
+
+static char screen[LCDBUF_DISPLAYS][LCDBUF_ROWS][LCDBUF_COLUMNS];
+// one bit per character that differs from the display
+static uint8_t dirty[LCDBUF_DISPLAYS][LCDBUF_ROWS][(LCDBUF_COLUMNS + 7) / 8];
+static uint8_t dirtyCount;
+// DDRAM address the display writes to next, saves setting the cursor
+static uint8_t cursor[LCDBUF_DISPLAYS];
+
+void lcdbuf_init(void) {
+	memset(screen, ' ', sizeof(screen));
+	memset(dirty, 0, sizeof(dirty));
+	dirtyCount = 0;
+	cursor[0] = cursor[1] = LCD_DDADR_LINE1;
+}
+
+static void put(uint8_t display, uint8_t row, uint8_t column, char c) {
+	if (screen[display][row][column] == c) return;
+	screen[display][row][column] = c;
+	uint8_t *bits = &dirty[display][row][column / 8];
+	uint8_t mask = 1 << (column % 8);
+	if (!(*bits & mask)) {
+		*bits |= mask;
+		dirtyCount++;
+	}
+}
+
+void lcdbuf_write(uint8_t display, uint8_t row, uint8_t column, const char *text, uint8_t len) {
+	if ((display < 1) || (display > LCDBUF_DISPLAYS) || (row < 1) || (row > LCDBUF_ROWS)) return;
+	while (len-- && (column < LCDBUF_COLUMNS))
+		put(display - 1, row - 1, column++, *text++);
+}
+
+void lcdbuf_string(uint8_t display, uint8_t row, uint8_t column, const char *text) {
+	lcdbuf_write(display, row, column, text, strlen(text));
+}
+
+void lcdbuf_clear_row(uint8_t display, uint8_t row, uint8_t column) {
+	while (column < LCDBUF_COLUMNS)
+		lcdbuf_write(display, row, column++, " ", 1);
+}
+
+uint8_t lcdbuf_poll(void) {
+	if (!dirtyCount) return 0;
+
+	for (uint8_t display = 0; display < LCDBUF_DISPLAYS; display++) {
+		for (uint8_t row = 0; row < LCDBUF_ROWS; row++) {
+			for (uint8_t i = 0; i < sizeof(dirty[0][0]); i++) {
+				uint8_t bits = dirty[display][row][i];
+				if (!bits) continue;
+
+				uint8_t column = i * 8;
+				while (!(bits & 1)) {
+					bits >>= 1;
+					column++;
+				}
+				dirty[display][row][i] &= ~(1 << (column % 8));
+				dirtyCount--;
+
+				uint8_t address = (row ? LCD_DDADR_LINE2 : LCD_DDADR_LINE1) + column;
+				lcd_select(display + 1);
+				if (cursor[display] != address)
+					lcd_setcursor(column, row + 1);
+				lcd_data(screen[display][row][column]);
+				cursor[display] = address + 1;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef LCD_BUFFER_H
+#define LCD_BUFFER_H
+
+#include <stdint.h>
+
+// Screen buffer for both displays. Text is written into the buffer, and
+// lcdbuf_poll() moves one changed character per call to the display, so
+// the main loop never stalls on the LCD. Characters that do not change
+// are not sent at all.
+
+#define LCDBUF_DISPLAYS 2
+#define LCDBUF_ROWS     2
+#define LCDBUF_COLUMNS  20
+
+// call after lcd_init() of both displays, the buffer starts out blank
+void lcdbuf_init(void);
+// display 1..2, row 1..2, column 0..19; text beyond the row is cut off
+void lcdbuf_write(uint8_t display, uint8_t row, uint8_t column, const char *text, uint8_t len);
+void lcdbuf_string(uint8_t display, uint8_t row, uint8_t column, const char *text);
+// blank the rest of a row, starting at column
+void lcdbuf_clear_row(uint8_t display, uint8_t row, uint8_t column);
+// sends one changed character, returns 0 if the displays are up to date
+uint8_t lcdbuf_poll(void);
+
+#endif
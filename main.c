@@ -7,36 +7,141 @@
 
 #define F_CPU 20000000
 
-#include <avr/io.h>
-#include <avr/wdt.h>
-#include <avr/eeprom.h>
-#include <avr/interrupt.h>
 #include <avr/pgmspace.h>
-#include <util/delay.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "usbdrv.h"
+#include "hal.h"
+#include "firmware.h"
 #include "lcd-routines.h"
+#include "lcd-buffer.h"
 #include "encoder.h"
+#include "gesture.h"
+#include "profile.h"
+#include "storage.h"
+#include "config.h"
+#include "state.h"
+#include "diag.h"
+#include "profiler.h"
+#include "latency.h"
+#include "trace.h"
+#include "chain.h"
 
 /* ------------------------------------------------------------------------- */
 
 #include "numsticks.h"
 
-static uchar    reportBuffers[NUMBER_OF_STICKS][8];
-static uchar    reportBufferSizes[NUMBER_OF_STICKS];
-static uchar    reportBufferChanged[NUMBER_OF_STICKS];
+#if AXIS_BITS == 16
+typedef uint16_t axisValue_t;
+typedef int32_t  axisSum_t;
+#define AXIS_MAX 0xffff
+#elif AXIS_BITS == 8
+typedef uchar    axisValue_t;
+typedef int16_t  axisSum_t;
+#define AXIS_MAX 0xff
+#else
+#error "AXIS_BITS must be 8 or 16"
+#endif
+
+#include "actions.h"
+
+// 1 byte report ID, 3 byte buttons, 4 axis values
+#define REPORT_SIZE (4 + 4 * sizeof(axisValue_t))
+// the interrupt endpoint moves at most 8 bytes per packet
+#define REPORT_PACKET_SIZE 8
+
+#if AXIS_PAGES > NUMBER_OF_STICKS || PROFILE_PAGES > NUMBER_OF_STICKS
+#error "AXIS_PAGES and PROFILE_PAGES cannot exceed NUMBER_OF_STICKS"
+#endif
+
+// Report storage, indexed by report ID - 1: the buttons of every report,
+// the axes only of the reports of axis pages (see axisSlot()). The
+// reports are put together in a packet buffer when they are sent.
+static uchar       reportButtons[REPORT_ID_MAX][3];
+static axisValue_t reportAxes[AXIS_REPORTS][4];
+// one bit per report: changed since it was last sent
+#define REPORT_BITMAP_SIZE ((REPORT_ID_MAX + 7) / 8)
+static uchar       reportDirty[REPORT_BITMAP_SIZE];
+
+#define REPORT_BIT(map, i)       ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define REPORT_BIT_SET(map, i)   ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+#define REPORT_BIT_CLEAR(map, i) ((map)[(i) >> 3] &= ~(1 << ((i) & 7)))
+
+#if DIAG_LATENCY
+// reports an input event changed in this pass: only these are stamped,
+// releasing a tap makes a report dirty without any input behind it
+static uchar       reportInput[REPORT_BITMAP_SIZE];
+#define REPORT_INPUT(i) REPORT_BIT_SET(reportInput, i)
+#else
+#define REPORT_INPUT(i)
+#endif
+// a report changed by an input event
+#define REPORT_CHANGED(i) do { REPORT_BIT_SET(reportDirty, i); REPORT_INPUT(i); } while (0)
+
+// packets being sent on the interrupt endpoint and for GET_REPORT
+static uchar       sendPacket[REPORT_SIZE];
+static uchar       getReportPacket[REPORT_SIZE];
+
+#define NO_AXES 0xff
+
+// row of reportAxes for report index i, NO_AXES on button pages
+static uchar axisSlot(uchar i) {
+	if (i < AXIS_PAGES) return i;
+#if SHIFT_LAYER
+	if (i >= NUMBER_OF_STICKS && i < NUMBER_OF_STICKS + AXIS_PAGES) return i - NUMBER_OF_STICKS + AXIS_PAGES;
+#endif
+	return NO_AXES;
+}
+
+// puts report index i together as it goes over the wire
+static void reportPacket(uchar i, uchar *packet) {
+	uchar slot = axisSlot(i);
+	packet[0] = i + 1;
+	memcpy(packet + 1, reportButtons[i], 3);
+	if (slot == NO_AXES)
+		memset(packet + 4, 0, sizeof(reportAxes[0]));
+	else
+		memcpy(packet + 4, reportAxes[slot], sizeof(reportAxes[0]));
+}
 
 static uchar selectedPage = 0;
 
-// report IDs start at 1
-#define REPORT_ID_MAX NUMBER_OF_STICKS
+#if AXIS_BITS == 16
+#define REPORT_DESCRIPTOR_AXES_SIZE 54
+#else
+#define REPORT_DESCRIPTOR_AXES_SIZE 50
+#endif
+#if DIAG_SOF_STAMP
+// the third button byte is a vendor defined frame counter
+#define REPORT_DESCRIPTOR_TEMPLATE_SIZE (REPORT_DESCRIPTOR_AXES_SIZE + 14)
+#else
+#define REPORT_DESCRIPTOR_TEMPLATE_SIZE REPORT_DESCRIPTOR_AXES_SIZE
+#endif
+
+// the vendor defined reports follow the sticks
+#define REPORT_ID_CONFIG (REPORT_ID_MAX + 1)
+#define REPORT_ID_LCD    (REPORT_ID_MAX + 2)
 
-const char usbHidReportDescriptorTemplate[50] = {
+// output report with text for the displays:
+// [0] report ID, [1] display (1..2), [2] row (1..2), [3] column (0..19),
+// [4] length, [5..24] text
+#define LCD_REPORT_SIZE 25
+#define LCD_REPORT_TEXT 5
 
-	// begin report descriptor for (1 byte ID, 3 byte buttons, 4 byte axis values)
-	// length is 50 byte, report length is 8 byte
+#define REPORT_DESCRIPTOR_TAIL_SIZE 31
+#define REPORT_DESCRIPTOR_LENGTH \
+	(REPORT_DESCRIPTOR_TEMPLATE_SIZE * REPORT_ID_MAX + REPORT_DESCRIPTOR_TAIL_SIZE)
+
+// the descriptor for all sticks exceeds 254 bytes with 16 bit axes
+#if (REPORT_DESCRIPTOR_LENGTH > 254) && !USB_CFG_LONG_TRANSFERS
+#error "report descriptor needs USB_CFG_LONG_TRANSFERS"
+#endif
+
+const char usbHidReportDescriptorTemplate[REPORT_DESCRIPTOR_TEMPLATE_SIZE] PROGMEM = {
+
+	// begin report descriptor for (1 byte ID, 3 byte buttons, 4 axis values)
+	// length is 50 byte (54 with 16 bit axes), report length is REPORT_SIZE
     0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
     0x09, 0x04,                    // USAGE (Joystick)
 	0xa1, 0x01,                    // COLLECTION (Application)
@@ -44,20 +149,41 @@ const char usbHidReportDescriptorTemplate[50] = {
     0x85, 0x01,                    //   REPORT_ID (1)
     0x05, 0x09,                    // USAGE_PAGE (Button)
     0x19, 0x01,                    // USAGE_MINIMUM (Button 1)
+#if DIAG_SOF_STAMP
+    0x29, 0x10,                    // USAGE_MAXIMUM (Button 16)
+    0x15, 0x00,                    // LOGICAL_MINIMUM (0)
+    0x25, 0x01,                    // LOGICAL_MAXIMUM (1)
+    0x75, 0x01,                    // REPORT_SIZE (1)
+    0x95, 0x10,                    // REPORT_COUNT (16)
+    0x81, 0x02,                    // INPUT (Data,Var,Abs)
+    0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor Defined Page 1)
+    0x09, 0x04,                    // USAGE (Vendor Usage 4: frame counter)
+    0x26, 0xff, 0x00,              // LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                    // REPORT_SIZE (8)
+    0x95, 0x01,                    // REPORT_COUNT (1)
+    0x81, 0x02,                    // INPUT (Data,Var,Abs)
+#else
     0x29, 0x18,                    // USAGE_MAXIMUM (Button 24)
     0x15, 0x00,                    // LOGICAL_MINIMUM (0)
     0x25, 0x01,                    // LOGICAL_MAXIMUM (1)
     0x75, 0x01,                    // REPORT_SIZE (1)
     0x95, 0x18,                    // REPORT_COUNT (24)
     0x81, 0x02,                    // INPUT (Data,Var,Abs)
+#endif
     0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
 	0x09, 0x33,                    //   USAGE (Rx)
     0x09, 0x34,                    //   USAGE (Ry)
     0x09, 0x35,                    //   USAGE (Rz)
     0x09, 0x36,                    //   USAGE (Slider)
+#if AXIS_BITS == 16
+    0x27, 0xff, 0xff, 0x00, 0x00,  //   LOGICAL_MAXIMUM (65535)
+    0x47, 0xff, 0xff, 0x00, 0x00,  //   PHYSICAL_MAXIMUM (65535)
+    0x75, 0x10,                    //   REPORT_SIZE (16)
+#else
     0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
     0x46, 0xff, 0x00,              //   PHYSICAL_MAXIMUM (255)
     0x75, 0x08,                    //   REPORT_SIZE (8)
+#endif
     0x95, 0x04,                    //   REPORT_COUNT (4)
     0x81, 0x02,                    // INPUT (Data,Var,Abs)
     0xc0,                           // END_COLLECTION
@@ -65,8 +191,37 @@ const char usbHidReportDescriptorTemplate[50] = {
 
 };
 
+// appended once after the sticks
+const char usbHidReportDescriptorTail[REPORT_DESCRIPTOR_TAIL_SIZE] PROGMEM = {
+    0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor Defined Page 1)
+    0x09, 0x01,                    // USAGE (Vendor Usage 1)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x85, REPORT_ID_CONFIG,        //   REPORT_ID (configuration, see config.h)
+    0x09, 0x02,                    //   USAGE (Vendor Usage 2)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                    //   REPORT_SIZE (8)
+    0x95, CONFIG_REPORT_SIZE - 1,  //   REPORT_COUNT (31)
+    0xb1, 0x02,                    //   FEATURE (Data,Var,Abs)
+    0x85, REPORT_ID_LCD,           //   REPORT_ID (display text)
+    0x09, 0x03,                    //   USAGE (Vendor Usage 3)
+    0x95, LCD_REPORT_SIZE - 1,     //   REPORT_COUNT (24)
+    0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+    0xc0,                          // END_COLLECTION
+};
+
+#define HID_REPORT_TYPE_INPUT   1
+#define HID_REPORT_TYPE_OUTPUT  2
+#define HID_REPORT_TYPE_FEATURE 3
+
 static uchar    idleRate;           /* in 4 ms units */
 
+// report ID of the SET_REPORT in progress
+static uchar writeReportId;
+static uchar lcdReport[LCD_REPORT_SIZE];
+static uchar lcdReportReceived;
+
+
 /* ------------------------------------------------------------------------- */
  
 void hadUsbReset(void) { return; }
@@ -79,55 +234,52 @@ static void resetButtonReleaseTimer() {
 	buttonReleaseDelayTimerCount = 0;
 	canReleaseButtons = 0;
 }
+
+// millisecond clock derived from the free running timer 0 (CK/1024).
+// clockFraction counts timer ticks * 32, F_CPU / 32000 of those make 1 ms.
+static uint16_t clockMs;
+static uint16_t clockFraction;
+static uchar clockLastCount;
+#define CLOCK_FRACTION_PER_MS (F_CPU / 32000)
+
 static void timerPoll(void)
 {
-	if (TIFR0 & (1<<TOV0)){ /* 22 ms timer */
-		TIFR0 = 1<<TOV0;  /* clear overflow */
-		if (++buttonReleaseDelayTimerCount >= 2){
+	uchar count = hal_timer_count();
+	clockFraction += (uchar)(count - clockLastCount) * 32;
+	clockLastCount = count;
+	while (clockFraction >= CLOCK_FRACTION_PER_MS) {
+		clockFraction -= CLOCK_FRACTION_PER_MS;
+		clockMs++;
+	}
+
+	if (hal_timer_overflow()){ /* 13 ms timer */
+		if (++buttonReleaseDelayTimerCount >= profile_settings.releaseDelay){
 			buttonReleaseDelayTimerCount = 0;
 			canReleaseButtons = 1;
 		}
 	}
 }
 
-static void hardwareInit(void)
-{
-	/**** SPI initialization ****/
-	// set PB2(/SS), PB3(MOSI), PB5(SCK) as output
-	DDRB    = (1<<PB2)|(1<<PB3)|(1<<PB5);
-	PORTB &= ~((1<<PB4)); // make sure MISO pull-up is disabled
-	PORTB &= ~(1<<PB2); // clear PARALLEL INPUT
-
-	TCCR0B = 5;      /* timer 0 prescaler: 1024 */
-}
-
-static uint8_t readByteSpi() {
-	// enable SPI in Master Mode with SCK = CK/128
-	SPCR    = (1<<SPE)|(1<<MSTR)|(1<<CPOL)|(1<<SPR0)|(1<<SPR1);
-	volatile char IOReg;
-	IOReg   = SPSR;                         // clear SPIF bit in SPSR
-	IOReg   = SPDR;
-
-	SPDR = 0x00; // shift out 8 bits (all zeroes here, nobody cares)
-		     // so 8 bits will be read back in
-        while (!(SPSR & (1<<SPIF)));
-	
-	return SPDR;
-}
-
 /* -------------------------------------------------------------------------------- */
 /* ------------------------ interface to USB driver ------------------------ */
 /* -------------------------------------------------------------------------------- */
 
 static usbMsgLen_t reportDescriptorBytesRead = 0;
-static usbMsgLen_t reportDescriptorBytes = sizeof(usbHidReportDescriptorTemplate) * NUMBER_OF_STICKS;
+static usbMsgLen_t reportDescriptorBytes = REPORT_DESCRIPTOR_LENGTH;
 static usbMsgLen_t reportDescriptorTemplatePos = 0;
+// usbFunctionRead() streams either the report descriptor or a diagnostics reply
+static uchar readingDiagnostics;
 uchar usbFunctionRead(uchar* data, uchar len) {
-	// assumption: usbFunctionRead() is only used to transfer the device descriptor
+	if (readingDiagnostics) return diag_read(data, len);
+
 	uchar i=0;
 	while ((i < len) && (reportDescriptorBytesRead < reportDescriptorBytes)) {
-		data[i] = usbHidReportDescriptorTemplate[reportDescriptorTemplatePos];
-		if (reportDescriptorTemplatePos == 9) data[i] = (reportDescriptorBytesRead / sizeof(usbHidReportDescriptorTemplate))+1;
+		if (reportDescriptorBytesRead >= sizeof(usbHidReportDescriptorTemplate) * REPORT_ID_MAX) {
+			data[i] = pgm_read_byte(&usbHidReportDescriptorTail[reportDescriptorBytesRead - sizeof(usbHidReportDescriptorTemplate) * REPORT_ID_MAX]);
+		} else {
+			data[i] = pgm_read_byte(&usbHidReportDescriptorTemplate[reportDescriptorTemplatePos]);
+			if (reportDescriptorTemplatePos == 9) data[i] = (reportDescriptorBytesRead / sizeof(usbHidReportDescriptorTemplate))+1;
+		}
 		i++;
 		reportDescriptorBytesRead++;
 		reportDescriptorTemplatePos++;
@@ -142,11 +294,12 @@ usbMsgLen_t usbFunctionDescriptor(struct usbRequest *rq) {
 		unsigned word;
 		uchar bytes[2];
 	} reportDescriptorLength;
-	reportDescriptorLength.word = sizeof(usbHidReportDescriptorTemplate) * NUMBER_OF_STICKS;
+	reportDescriptorLength.word = REPORT_DESCRIPTOR_LENGTH;
 
 
 	// see which descriptor we are being asked for
 	if (rq->wValue.bytes[1] == USBDESCR_HID_REPORT) {
+		readingDiagnostics = 0;
 		reportDescriptorBytesRead = 0;
 		reportDescriptorTemplatePos = 0;
 		return USB_NO_MSG;
@@ -163,8 +316,8 @@ usbMsgLen_t usbFunctionDescriptor(struct usbRequest *rq) {
 			//			sizeof(usbHidReportDescriptorTemplate)*NUMBER_OF_STICKS, 0,
 			0x00, 0x00 /* total length of report descriptor */
 		};
-		hidDescriptor[7] = reportDescriptorLength.bytes[1];
-		hidDescriptor[8] = reportDescriptorLength.bytes[0];
+		hidDescriptor[7] = reportDescriptorLength.bytes[0];
+		hidDescriptor[8] = reportDescriptorLength.bytes[1];
 
 		usbMsgPtr = (uchar*)&hidDescriptor;
 		return sizeof(hidDescriptor);
@@ -216,175 +369,222 @@ usbMsgLen_t usbFunctionDescriptor(struct usbRequest *rq) {
 		usbMsgPtr = (uchar*)&configDescriptor;
 		return sizeof(configDescriptor);
 	}
+	return 0;
 }
 
+// the 8 byte setup packet. usbdrv's usbRequest_t holds its words as
+// unsigned, which is 4 bytes in the host build, so it does not fit there.
+typedef struct {
+	uchar bmRequestType;
+	uchar bRequest;
+	uchar wValue[2];
+	uchar wIndex[2];
+	uchar wLength[2];
+} setupPacket_t;
+typedef char setupPacket_size[(sizeof(setupPacket_t) == 8) ? 1 : -1];
+
 usbMsgLen_t	usbFunctionSetup(uchar data[8])
 {
-usbRequest_t    *rq = (void *)data;
+setupPacket_t   *rq = (void *)data;
 
     usbMsgPtr = NULL;
     if((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS){    /* class request type */
         if(rq->bRequest == USBRQ_HID_GET_REPORT){  /* wValue: ReportType (highbyte), ReportID (lowbyte) */
-			usbMsgPtr = reportBuffers[rq->wValue.bytes[1] - 1];
-			return reportBufferSizes[rq->wValue.bytes[1] - 1];
+			uchar reportId = rq->wValue[0];
+			if (rq->wValue[1] == HID_REPORT_TYPE_FEATURE && reportId == REPORT_ID_CONFIG) {
+				usbMsgPtr = config_report(reportId);
+				return CONFIG_REPORT_SIZE;
+			}
+			if (reportId < 1 || reportId > REPORT_ID_MAX) reportId = 1;
+			reportPacket(reportId - 1, getReportPacket);
+			usbMsgPtr = getReportPacket;
+			return REPORT_SIZE;
+        }else if(rq->bRequest == USBRQ_HID_SET_REPORT){
+			/* data arrives through usbFunctionWrite() */
+			writeReportId = rq->wValue[0];
+			if (rq->wValue[1] == HID_REPORT_TYPE_FEATURE && writeReportId == REPORT_ID_CONFIG) {
+				config_begin();
+				return USB_NO_MSG;
+			}
+			if (rq->wValue[1] == HID_REPORT_TYPE_OUTPUT && writeReportId == REPORT_ID_LCD) {
+				lcdReportReceived = 0;
+				return USB_NO_MSG;
+			}
         }else if(rq->bRequest == USBRQ_HID_GET_IDLE){
             usbMsgPtr = &idleRate;
             return 1;
         }else if(rq->bRequest == USBRQ_HID_SET_IDLE){
-            idleRate = rq->wValue.bytes[1];
+            idleRate = rq->wValue[1];
         }
     }else{
-        /* no vendor specific requests implemented */
+        /* vendor requests: diagnostics, see diag.h */
+        readingDiagnostics = 1;
+        return diag_setup(rq->bRequest, rq->wValue[0] | (rq->wValue[1] << 8),
+                          rq->wLength[0] | (rq->wLength[1] << 8), &usbMsgPtr);
     }
 	return 0;
 }
 
+uchar usbFunctionWrite(uchar *data, uchar len)
+{
+	if (writeReportId == REPORT_ID_CONFIG)
+		return config_write(data, len);
+
+	// display text: only goes to the screen buffer, lcdbuf_poll() does the rest
+	while (len-- && lcdReportReceived < LCD_REPORT_SIZE)
+		lcdReport[lcdReportReceived++] = *data++;
+	if (lcdReportReceived < LCD_REPORT_SIZE) return 0;
+	uchar textLength = lcdReport[4];
+	if (textLength > LCD_REPORT_SIZE - LCD_REPORT_TEXT) textLength = LCD_REPORT_SIZE - LCD_REPORT_TEXT;
+	lcdbuf_write(lcdReport[1], lcdReport[2], lcdReport[3], (char *)&lcdReport[LCD_REPORT_TEXT], textLength);
+	return 1;
+}
+
 /* ------------------------------------------------------------------------- */
 /* --------------------------------- main ---------------------------------- */
 /* ------------------------------------------------------------------------- */
 
-void parallelIn() {
-
-	PORTB |= (1<<PB2); // set PARALLEL INPUT
-	_delay_us(1);
+// taps waiting for their release, one entry per report: a button tapped
+// on one page may be held on another, so the masks must not be shared.
+// Within a page the press and tap buttons are distinct.
+#define RELEASE_SLOTS 4
+typedef struct {
+	uchar reportId; // 0: free
+	uchar buttons[3];
+} release_t;
+static release_t releases[RELEASE_SLOTS];
+
+static void releaseTaps(release_t *release) {
+	uchar *buttons = reportButtons[release->reportId-1];
+	buttons[0] &= ~release->buttons[0];
+	buttons[1] &= ~release->buttons[1];
+	buttons[2] &= ~release->buttons[2];
+	REPORT_BIT_SET(reportDirty, release->reportId-1);
+	memset(release, 0, sizeof(release_t));
+}
 
-	PORTB &= ~(1<<PB2); // clear PARALLEL INPUT
-	_delay_us(1);
+// the entry collecting the taps of a report; when all are taken, the taps
+// of a report that already went out are released early to make room.
+// NULL if every entry still waits for its report to be sent.
+static release_t *releaseEntry(uchar reportId) {
+	release_t *entry = NULL;
+	uchar i;
+	for (i=0; i<RELEASE_SLOTS; i++) {
+		if (releases[i].reportId == reportId) return &releases[i];
+		if (!releases[i].reportId) entry = &releases[i];
+	}
+	if (entry) return entry;
+	for (i=0; i<RELEASE_SLOTS; i++) {
+		if (!REPORT_BIT(reportDirty, releases[i].reportId-1)) {
+			releaseTaps(&releases[i]);
+			return &releases[i];
+		}
+	}
+	return NULL;
+}
 
+void axisDelta(uchar reportId, uchar axisNumber, axisSum_t delta) {
+	uchar slot = axisSlot(reportId-1);
+	if (slot == NO_AXES) return;
+	axisValue_t* value = &reportAxes[slot][axisNumber];
+	axisSum_t temp = ((axisSum_t) *value) + delta;
+	if (temp < 0) temp = 0;
+	if (temp > AXIS_MAX) temp = AXIS_MAX;
+	if (*value != temp) {
+		*value = temp;
+		REPORT_CHANGED(reportId-1);
+		state_changed(clockMs);
+	}
 }
 
-// bitmask; buttonTap sets a bit here, so the button is released later
-static uchar buttonsAwaitingRelease[NUMBER_OF_STICKS][3];
+// report ID the dials send to, indexed by the shift state; set up by selectPage()
+static uchar layerReportId[2];
+static uchar shifted = 0;
 
-void noAction() {}
-void buttonDown(uchar reportId, uchar buttonNumber) {
-	reportBuffers[reportId-1][1 + ((buttonNumber-1)/8)] |= (1 << (buttonNumber-1)%8);
-	reportBufferChanged[reportId-1] = 1;
-}
-void buttonUp(uchar reportId, uchar buttonNumber) {
-	reportBuffers[reportId-1][1 + ((buttonNumber-1)/8)] &= ~(1 << (buttonNumber-1)%8);
-	reportBufferChanged[reportId-1] = 1;
-}
-void buttonTap(uchar reportId, uchar buttonNumber) {
-	buttonDown(reportId, buttonNumber);
-	buttonsAwaitingRelease[reportId-1][(buttonNumber-1)/8] |= (1 << ((buttonNumber-1)%8));
-	resetButtonReleaseTimer();
+// actions of the current page, see actions.h
+static action_t pageActions[NUMBER_OF_ENCODERS][ECEV_COUNT];
+static const action_t selectorActions[ECEV_COUNT] PROGMEM = PAGE_SELECTOR;
+
+static void buttonAction(action_t *action, uchar type, uchar button) {
+	action->type = type;
+	action->index = BUTTON_BYTE(button);
+	action->value = BUTTON_MASK(button);
 }
-void axisDelta(uchar reportId, uchar axisNumber, char delta) {
-	uchar* value = &reportBuffers[reportId-1][3+axisNumber];
-	int16_t temp = ((int16_t) *value) + (int16_t)delta;
-	if ((0 <= temp) && (temp <= 255))
-		*value += delta;
-	reportBufferChanged[reportId-1] = 1;
+
+static void compilePage(uchar page) {
+	binding_t binding;
+
+	memset(pageActions, 0, sizeof(pageActions));
+	for (uchar dial=0; dial<NUMBER_OF_DIALS; dial++) {
+		action_t *actions = pageActions[dial];
+		profile_binding(page, dial, &binding);
+		uchar gestures = binding.gestures;
+#if DIAG_SOF_STAMP
+		if (gestures + 2 > 16) gestures = 0;
+#endif
+		// gestures tap their own buttons, on a dial of any kind
+		if (gestures) {
+			buttonAction(&actions[4], ACT_TAP, gestures);
+			buttonAction(&actions[5], ACT_TAP, gestures + 1);
+			buttonAction(&actions[6], ACT_TAP, gestures + 2);
+		}
+		if (binding.kind == BIND_NONE) continue;
+
+		uchar axis = (binding.kind & BIND_AXIS) && page <= AXIS_PAGES;
+#if DIAG_SOF_STAMP
+		// buttons 17..24 share their byte with the frame counter
+		if (binding.button + (axis ? 0 : 2) > 16) continue;
+#endif
+
+		buttonAction(&actions[0], ACT_PRESS, binding.button);
+		buttonAction(&actions[1], ACT_RELEASE, binding.button);
+		if (axis) {
+			actions[2].type = ACT_AXIS_DEC;
+			actions[3].type = ACT_AXIS_INC;
+			actions[2].index = actions[3].index = binding.kind & 0x03;
+			uint16_t step = BINDING_STEP(&binding);
+			actions[2].value = actions[3].value = step > AXIS_MAX ? AXIS_MAX : step;
+		} else {
+			buttonAction(&actions[2], ACT_TAP, binding.button + 1);
+			buttonAction(&actions[3], ACT_TAP, binding.button + 2);
+		}
+	}
+	memcpy_P(pageActions[PAGE_SELECTOR_ENCODER], selectorActions, sizeof(selectorActions));
 }
 
+// set by selectPage(), the page is loaded by loadPage() once the profile
+// can be read without waiting for an EEPROM write
+static uchar pageLoadPending;
+
 void selectPage(uchar page) {
 	selectedPage = page;
-	if (page == 1) {
-		lcd_select(2);
-		lcd_clear();
-		lcd_string("Lighting Panel");
-		
-		lcd_select(1);
-		lcd_clear();
-		lcd_string("CONS ");
-		lcd_string("ENG  ");
-		lcd_string("FLTI ");
-		lcd_string("FLOOD");
-		lcd_setcursor(0,2);
-		lcd_string("FORM ");
-		lcd_string("NOSE ");
-		lcd_string("POS  ");
-		lcd_string("SIGNL");
-	} else if (page == 2) {
-		lcd_select(2);
-		lcd_clear();
-		lcd_string("AAP");
-		lcd_setcursor(0,2);
-		lcd_string("Electrical Panel");
-		
-		lcd_select(1);
-		lcd_clear();
-		lcd_string("CDU  ");
-		lcd_string("EGI  ");
-		lcd_string("EmFld");
-		lcd_string(" BAT ");
-		lcd_setcursor(0,2);
-		lcd_string("GenL ");
-		lcd_string("GenR ");
-		lcd_string("GenA ");
-		lcd_string("Inv  ");
-	} else if (page == 3) {
-		lcd_select(2);
-		lcd_clear();
-		lcd_string("Fuel System");
-		
-		lcd_select(1);
-		lcd_clear();
-		lcd_string("  BOO");
-		lcd_string("ST   ");
-		lcd_string("TkGt ");
-		lcd_string("RcvrL");
-		lcd_setcursor(0,2);
-		lcd_string("   PU");
-		lcd_string("MPS  ");
-		lcd_string("     ");
-		lcd_string("     ");
-	} else if (page == 4) {
-		lcd_select(2);
-		lcd_clear();
-		lcd_string("AHCP");
-		
-		lcd_select(1);
-		lcd_clear();
-		lcd_string("MArm ");
-		lcd_string("GUN  ");
-		lcd_string("Laser");
-		lcd_string(" TGP ");
-		lcd_setcursor(0,2);
-		lcd_string("CICU ");
-		lcd_string("JTRS ");
-		lcd_string("IFFCC");
-		lcd_string("     ");
-	} else if (page == 5) {
-		lcd_select(2);
-		lcd_clear();
-		lcd_string("Intercom");
-		
-		lcd_select(1);
-		lcd_clear();
-		lcd_string("FM   ");
-		lcd_string("HF   ");
-		lcd_string("INT  ");
-		lcd_string("VHF  ");
-		lcd_setcursor(0,2);
-		lcd_string("TCN  ");
-		lcd_string("ILS  ");
-		lcd_string("AIM  ");
-		lcd_string("Vol  ");
-	} else if (page == 6) {
-		lcd_select(2);
-		lcd_clear();
-		lcd_string("TACAN and ILS");
-		
-		lcd_select(1);
-		lcd_clear();
-		lcd_string("TCN C");
-		lcd_string("hanne");
-		lcd_string("l    ");
-		lcd_string("     ");
-		lcd_setcursor(0,2);
-		lcd_string("ILS F");
-		lcd_string("reque");
-		lcd_string("ncy  ");
-		lcd_string("     ");
-	} else {
-		lcd_select(2);
-		lcd_clear();
-		lcd_string("Page "); lcd_num(page);
-		
-		lcd_select(1);
-		lcd_clear();
+	state_changed(clockMs);
+	TRACE_PAGE(page);
+	pageLoadPending = 1;
+}
+
+static void loadPage(void) {
+	char text[PROFILE_TITLE_LENGTH + 1];
+	uchar page = selectedPage;
+
+	pageLoadPending = 0;
+	layerReportId[0] = page;
+	layerReportId[1] = SHIFT_LAYER ? NUMBER_OF_STICKS + page : page;
+	compilePage(page);
+
+	// row 2 of display 2 belongs to the host, see REPORT_ID_LCD
+	profile_title(page, text);
+	if (!text[0]) {
+		strcpy(text, "Page ");
+		utoa(page, text + 5, 10);
+	}
+	lcdbuf_string(2, 1, 0, text);
+	lcdbuf_clear_row(2, 1, strlen(text));
+
+	// two rows of four labels, further dials go without
+	for (uchar dial=0; dial<NUMBER_OF_DIALS && dial<8; dial++) {
+		profile_label(page, dial, text);
+		lcdbuf_write(1, 1 + dial / 4, (dial % 4) * PROFILE_LABEL_LENGTH, text, PROFILE_LABEL_LENGTH);
 	}
 }
 void nextPage() {
@@ -398,131 +598,266 @@ void previousPage() {
 	selectPage(selectedPage);
 }
 
-void handleInput(uchar events[9]) {
-	uchar event;
-
-	/* set buttons 1 to 24 to react to dials 1 through 8 */
-	for (uchar i=0; i<8; i++) {
-		event = events[i];
-		if (event & ECEV_BUTTON_DOWN) buttonDown(selectedPage,1+(i*3));
-		if (event & ECEV_BUTTON_UP) buttonUp(selectedPage,1+(i*3));
-		if (event & ECEV_LEFT) buttonTap(selectedPage,2+(i*3));
-		if (event & ECEV_RIGHT) buttonTap(selectedPage,3+(i*3));	
+// report ID that got the push of each dial's button, so the release goes
+// to the same stick even if the page or shift state changed meanwhile
+static uchar pressedReportId[NUMBER_OF_ENCODERS];
+// encoder whose button switched the shift layer on
+static uchar shiftEncoder;
+
+void handleInput(uchar events[NUMBER_OF_ENCODERS]) {
+	// detents of all dials mapped to the same axis are summed up and applied once
+	axisSum_t axisDeltas[4] = {0, 0, 0, 0};
+	uchar reportId = layerReportId[shifted];
+	uchar used = 0;
+
+	for (uchar i=0; i<NUMBER_OF_ENCODERS; i++) {
+		uchar event = events[i];
+		const action_t *action = pageActions[i];
+		for (; event; event >>= 1, action++) {
+			if (!(event & 1)) continue;
+			uchar *buttons = reportButtons[reportId-1];
+			switch (action->type) {
+				case ACT_PRESS:
+					pressedReportId[i] = reportId;
+					buttons[action->index-1] |= action->value;
+					REPORT_CHANGED(reportId-1);
+					used = 1;
+					break;
+				case ACT_RELEASE:
+					if (pressedReportId[i]) {
+						reportButtons[pressedReportId[i]-1][action->index-1] &= ~action->value;
+						REPORT_CHANGED(pressedReportId[i]-1);
+					}
+					break;
+				case ACT_TAP: {
+					release_t *release = releaseEntry(reportId);
+					if (!release) break; // no room to release it later, drop the tap
+					release->reportId = reportId;
+					release->buttons[action->index-1] |= action->value;
+					buttons[action->index-1] |= action->value;
+					REPORT_CHANGED(reportId-1);
+					resetButtonReleaseTimer();
+					used = 1;
+					break;
+				}
+				case ACT_AXIS_INC:
+					axisDeltas[action->index] += action->value;
+					used = 1;
+					break;
+				case ACT_AXIS_DEC:
+					axisDeltas[action->index] -= action->value;
+					used = 1;
+					break;
+				case ACT_PAGE_NEXT:
+					nextPage();
+					break;
+				case ACT_PAGE_PREVIOUS:
+					previousPage();
+					break;
+				case ACT_PAGE_SELECT:
+					selectPage(action->index);
+					break;
+				case ACT_SHIFT_ON:
+					shifted = SHIFT_LAYER;
+					shiftEncoder = i;
+					break;
+				case ACT_SHIFT_OFF:
+					shifted = 0;
+					break;
+			}
+		}
 	}
 
-	if (events[8] & ECEV_LEFT) previousPage();
-	if (events[8] & ECEV_RIGHT) nextPage();
-	if (events[8] & ECEV_BUTTON_UP) selectPage(1);
+	for (uchar axis=0; axis<4; axis++)
+		if (axisDeltas[axis]) axisDelta(reportId, axis, axisDeltas[axis]);
 
+	// the shift button was used as a modifier, not clicked
+	if (shifted && used) gesture_cancel((gesture_mask_t)1 << shiftEncoder);
 }
 
-int main(void)
+// the state kept by state.c: selected page and axis values
+static void stateGet(uchar *state) {
+	state[0] = selectedPage;
+	for (uchar i=0; i<state_sticks; i++)
+		memcpy(&state[STATE_STICK_OFFSET(i)], reportAxes[i], STATE_AXIS_BYTES);
+}
+
+static void stateSet(const uchar *state) {
+	selectedPage = state[0];
+	if (selectedPage < 1 || selectedPage > NUMBER_OF_STICKS) selectedPage = 1;
+	for (uchar i=0; i<state_sticks; i++)
+		memcpy(reportAxes[i], &state[STATE_STICK_OFFSET(i)], STATE_AXIS_BYTES);
+}
+
+// scan loop state
+static uint8_t events[NUMBER_OF_ENCODERS];
+// start from the resting state so the first scan does not count as a skipped step
+static uint8_t oldstates[NUMBER_OF_ENCODERS];
+static uint8_t newstates[NUMBER_OF_ENCODERS];
+static uint16_t gestureTickMs;
+static uint8_t startReportId;
+// rest of a report longer than one packet, sent before anything else
+static uchar *pendingReportData;
+static uchar pendingReportBytes;
+
+FIRMWARE_FUNCTION void firmware_init(void)
 {
 	uchar   i;
+	uchar   state[STATE_MAX_SIZE];
     
-	memset(buttonsAwaitingRelease, 0, sizeof(buttonsAwaitingRelease));
-	memset(reportBuffers, 0, NUMBER_OF_STICKS * 8);
-	for (i=0; i<NUMBER_OF_STICKS;i++) {
-		reportBuffers[i][0] = i+1;   // set REPORT IDs
-		reportBufferChanged[i] = 1;
-		reportBufferSizes[i] = 8;
-	}
+	memset(oldstates, ECST_RESTING_STATE, sizeof(oldstates));
+	memset(releases, 0, sizeof(releases));
+	memset(reportButtons, 0, sizeof(reportButtons));
+	memset(reportAxes, 0, sizeof(reportAxes));
+	// every report goes out once at the start
+	for (i=0; i<REPORT_ID_MAX;i++)
+		REPORT_BIT_SET(reportDirty, i);
+	// restore page and axes before the first report goes out
+	selectedPage = 1;
+	if (state_load(state)) stateSet(state);
 	
-    usbInit();
-    usbDeviceDisconnect();  /* enforce re-enumeration, do this while interrupts are disabled! */
-    i = 0;
-    while(--i){             /* fake USB disconnect for > 250 ms */
-        wdt_reset();
-        _delay_ms(1);
-    }
-    usbDeviceConnect();
-
-    wdt_enable(WDTO_2S);
-
-    hardwareInit();
+	hal_usb_connect();
+	hal_init();
 	
 	lcd_select(1);
 	lcd_init();
 	lcd_clear();
-	lcd_string("Hello.");
 	
 	lcd_select(2);
 	lcd_init();
 	lcd_clear();
 
-	selectPage(1);
+	lcdbuf_init();
+	lcdbuf_string(1, 1, 0, "Hello.");
+
+	storage_init();
+	profile_init();
+	selectPage(selectedPage);
+	loadPage();
 	
-    sei();
+	hal_enable_interrupts();
 
-	static uint8_t events[9] =    {0,0,0,0,0,0,0,0,0};
-	static uint8_t oldstates[9] = {0,0,0,0,0,0,0,0,0};
-	static uint8_t newstates[9] = {0,0,0,0,0,0,0,0,0};
+#if DIAG_PROFILER
+	profiler_init();
+#endif
+#if DIAG_LATENCY
+	latency_init();
+#endif
+}
 
-    for(;;){    /* main event loop */
-		/* */
-		parallelIn();
-		uint8_t byte = readByteSpi();
-		newstates[0] = (byte >> 5);
-		newstates[1] = (byte >> 2);
-		newstates[2] = ((byte << 1) & 0b00000110);
-
-		byte = readByteSpi();
-		newstates[2] |= ((byte >> 7) & 0b00000001);
-		newstates[3] = (byte >> 4);
-		newstates[4] = (byte >> 1);
-		newstates[5] = (byte << 2) & 0b00000100;
-
-		byte = readByteSpi();
-		newstates[5] |= ((byte >> 6) & 0b00000011);
-		newstates[6] = (byte >> 3);
-		newstates[7] = byte;
-		
-		byte = readByteSpi();
-		newstates[8] = (byte >> 5);
-		
-		for (uint8_t i = 0; i<9; i++) {
-			events[i] = encoder_events(oldstates[i], newstates[i]);
-		}
+// one pass of the main loop
+FIRMWARE_FUNCTION void firmware_step(void)
+{
+	uchar   i;
 
-		handleInput(events);
-		
-		for (uint8_t i=0; i<9; i++)
-			oldstates[i] = newstates[i];
-
-        wdt_reset();
-        usbPoll();
-
-		timerPoll();
-		if (canReleaseButtons) {
-			for (i=0; i<REPORT_ID_MAX; i++) {
-				if (reportBufferChanged[i] == 0) {
-					// check if we want to release some buttons
-					for (uint8_t j=0; j<3; j++) {
-						if (buttonsAwaitingRelease[i][j] > 0) {
-							reportBuffers[i][1+j] &= ~(buttonsAwaitingRelease[i][j]);
-							buttonsAwaitingRelease[i][j] = 0x00;
-							reportBufferChanged[i] = 1;
-						}
-					}
-				}
-			}
+	PROFILE_START();
+	LATENCY_SCAN(clockMs);
+	TRACE_TICK(clockMs);
+	uint8_t chain[HAL_CHAIN_BYTES];
+	hal_read_chain(chain);
+	TRACE_SNAPSHOT(chain);
+
+	chain_unpack(chain, newstates);
+	PROFILE_STAGE(PROF_SPI);
+	
+	gesture_mask_t buttonsDown = 0, buttonsUp = 0, bit = 1;
+	for (uint8_t i = 0; i<NUMBER_OF_ENCODERS; i++) {
+		events[i] = encoder_events(i, oldstates[i], newstates[i]);
+		if (events[i] & ECEV_BUTTON_DOWN) buttonsDown |= bit;
+		if (events[i] & ECEV_BUTTON_UP) buttonsUp |= bit;
+		bit <<= 1;
+	}
+
+	uchar gestureTick = (uint16_t)(clockMs - gestureTickMs) >= GESTURE_TICK_MS;
+	if (gestureTick) gestureTickMs += GESTURE_TICK_MS;
+	gestures_t gestures;
+	gesture_update(buttonsDown, buttonsUp, gestureTick, &gestures);
+	if (gestures.shortpress | gestures.longpress | gestures.doubleclick) {
+		bit = 1;
+		for (uint8_t i = 0; i<NUMBER_OF_ENCODERS; i++) {
+			if (gestures.shortpress & bit) events[i] |= ECEV_SHORT_PRESS;
+			if (gestures.longpress & bit) events[i] |= ECEV_LONG_PRESS;
+			if (gestures.doubleclick & bit) events[i] |= ECEV_DOUBLE_CLICK;
+			bit <<= 1;
 		}
+	}
+#if DIAG_TRACE
+	for (uint8_t i = 0; i<NUMBER_OF_ENCODERS; i++)
+		if (events[i]) TRACE_EVENTS(i, events[i]);
+#endif
+	PROFILE_STAGE(PROF_DECODE);
 
-		static uint8_t startReportId = 0;
-		if(usbInterruptIsReady()){ /* we can send another report */
+	handleInput(events);
+	LATENCY_EVENTS(reportInput);
+	// before storage_poll() and state_poll() start the next EEPROM write
+	if (pageLoadPending && profile_ready()) loadPage();
+	
+	for (uint8_t i=0; i<NUMBER_OF_ENCODERS; i++)
+		oldstates[i] = newstates[i];
+	PROFILE_STAGE(PROF_INPUT);
+
+	hal_wdt_reset();
+	hal_usb_poll();
+	PROFILE_STAGE(PROF_USB);
+
+	storage_poll();
+	profile_poll();
+	if (config_take_committed() == selectedPage) selectPage(selectedPage);
+	lcdbuf_poll();
+	if (state_due(clockMs)) {
+		uchar state[STATE_MAX_SIZE];
+		stateGet(state);
+		state_save(state);
+	}
+	state_poll();
+
+	timerPoll();
+	if (canReleaseButtons) {
+		// release the taps of reports that went out since
+		for (i=0; i<RELEASE_SLOTS; i++) {
+			if (releases[i].reportId && !REPORT_BIT(reportDirty, releases[i].reportId-1))
+				releaseTaps(&releases[i]);
+		}
+	}
+	PROFILE_STAGE(PROF_HOUSEKEEPING);
+
+	if(hal_usb_ready()){ /* we can send another report */
+		if (pendingReportBytes) {
+			uchar len = pendingReportBytes > REPORT_PACKET_SIZE ? REPORT_PACKET_SIZE : pendingReportBytes;
+			hal_usb_send(pendingReportData, len);
+			pendingReportData += len;
+			pendingReportBytes -= len;
+		} else {
 			startReportId++;
 			for (uint8_t k = 0; k < REPORT_ID_MAX; k++) {
 				uint8_t i = (startReportId + k) % (REPORT_ID_MAX);
-				if (reportBufferChanged[i]) {
-					usbSetInterrupt(reportBuffers[i], reportBufferSizes[i]);
-					reportBufferChanged[i] = 0;
+				if (REPORT_BIT(reportDirty, i)) {
+					uchar len = REPORT_SIZE > REPORT_PACKET_SIZE ? REPORT_PACKET_SIZE : REPORT_SIZE;
+					reportPacket(i, sendPacket);
+#if DIAG_SOF_STAMP
+					sendPacket[3] = hal_usb_frame();
+#endif
+					hal_usb_send(sendPacket, len);
+					LATENCY_SENT(i, clockMs);
+					TRACE_REPORT(i + 1);
+					pendingReportData = sendPacket + len;
+					pendingReportBytes = REPORT_SIZE - len;
+					REPORT_BIT_CLEAR(reportDirty, i);
 					break;
 				}
 			}
-			
 		}
-        
 	}
-   	return 0;
+	PROFILE_STAGE(PROF_REPORT);
+}
 
+#ifndef HAL_HOST
+int main(void)
+{
+	firmware_init();
+    for(;;){    /* main event loop */
+		firmware_step();
+	}
+   	return 0;
 }
+#endif
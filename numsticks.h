@@ -3,6 +3,66 @@
 
 #define NUMBER_OF_STICKS 5
 
+// 1: while the page selector's button is held, the dials report to a second
+// set of report IDs (NUMBER_OF_STICKS + page) instead of their page's stick
+#define SHIFT_LAYER 1
+
+// report IDs start at 1; 1..NUMBER_OF_STICKS are the pages,
+// the shift layer adds another NUMBER_OF_STICKS behind them
+#define REPORT_ID_MAX (NUMBER_OF_STICKS * (1 + SHIFT_LAYER))
+
+// pages 1..AXIS_PAGES (and their shift layer reports) keep four axis
+// values in RAM, the pages after them are button pages: an axis binding
+// acts as buttons there and their reports send the axes as 0.
+#define AXIS_PAGES NUMBER_OF_STICKS
+#define AXIS_REPORTS (AXIS_PAGES * (1 + SHIFT_LAYER))
+
+// RAM per page, shift layer included: 3 button bytes and a dirty bit per
+// report, the axes on axis pages. 6 and 14 bytes (+2 bits) with the shift
+// layer and 8 bit axes; GET_CONFIG reports them. Pending tap releases take
+// another 16 bytes whatever the page count.
+#define PAGE_RAM_BYTES      ((1 + SHIFT_LAYER) * 3)
+#define AXIS_PAGE_RAM_BYTES (PAGE_RAM_BYTES + (1 + SHIFT_LAYER) * 4 * AXIS_BITS / 8)
+
+// e.g. 16 pages with the dimmers on page 1, 124 bytes of report storage instead of 416:
+//#define NUMBER_OF_STICKS 16
+//#define AXIS_PAGES 1
+
+// eight dials plus the page selector, up to 24 encoders in all. The chain
+// layout can also come from the command line, see host/fuzz-wide.
+#ifndef NUMBER_OF_ENCODERS
+#define NUMBER_OF_ENCODERS 9
+#endif
+// the last encoder selects the page, the others are the dials of a page
+#define PAGE_SELECTOR_ENCODER (NUMBER_OF_ENCODERS - 1)
+#define NUMBER_OF_DIALS (NUMBER_OF_ENCODERS - 1)
+
+// the 74HC165 chain: CHAIN_BYTES are shifted in per scan, the first bit
+// shifted in is the MSB of byte 0. Encoder n takes the three bits from
+// bit ENCODER_CHAIN_BIT(n) on: quadrature A, B and the button (see
+// encoder.h). It has to be a constant expression the preprocessor can
+// evaluate; chain.h generates the unpacking from it. Back to back:
+#ifndef CHAIN_BYTES
+#define CHAIN_BYTES 4
+#define ENCODER_CHAIN_BIT(n) (3 * (n))
+#endif
+// one encoder per nibble, e.g. 16 encoders on 8 bytes:
+//#define ENCODER_CHAIN_BIT(n) (4 * (n))
+
+// detents per quadrature cycle: 1 (full step), 2 (half step) or 4 (quarter step).
+// ENCODER_RESOLUTION fixes it for all encoders at compile time. Defining
+// ENCODER_RESOLUTIONS instead gives every encoder its own entry in a runtime
+// table, initialised from that list and changeable with encoder_set_resolution().
+#ifndef ENCODER_RESOLUTIONS
+#define ENCODER_RESOLUTION 1
+//#define ENCODER_RESOLUTIONS 1, 1, 1, 1, 1, 1, 1, 1, 1
+#endif
+
+// resolution of the four axes (Rx, Ry, Rz, Slider) in every report:
+//  8 -> 8 byte reports, one interrupt packet each
+// 16 -> 12 byte reports, sent as two interrupt packets (8 + 4 bytes)
+#define AXIS_BITS 8
+
 
 #endif
 
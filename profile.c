@@ -0,0 +1,298 @@
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include "profile.h"
+#include "storage.h"
+#include "encoder.h"
+
+typedef char profile_sizes[(sizeof(binding_t) == PROFILE_BINDING_SIZE &&
+	sizeof(profile_page_t) == PROFILE_PAGE_SIZE &&
+	sizeof(profile_settings_t) == PROFILE_SETTINGS_SIZE &&
+	sizeof(profile_page_slot_t) == PROFILE_PAGE_SIZE + PROFILE_SLOT_OVERHEAD &&
+	sizeof(profile_settings_slot_t) == PROFILE_SETTINGS_SIZE + PROFILE_SLOT_OVERHEAD) ? 1 : -1];
+typedef char profile_fits_eeprom[(sizeof(profile_eeprom_t) + 1 + STATE_MAX_SIZE <= E2END + 1) ? 1 : -1];
+
+#define BUTTONS(i)          { BIND_BUTTONS, 1+3*(i), { 0, 0 }, 0 }
+#define AXIS(i, axis, step) { BIND_AXIS | (axis), 1+3*(i), { (step) & 0xff, (step) >> 8 }, 0 }
+#define BUTTON_PAGE { \
+	BUTTONS(0), BUTTONS(1), BUTTONS(2), BUTTONS(3), \
+	BUTTONS(4), BUTTONS(5), BUTTONS(6), BUTTONS(7) }
+
+// full travel in 32 detents
+#define DIMMER_STEP (((1L << AXIS_BITS) - 1) / 32)
+
+#ifdef ENCODER_RESOLUTION
+#define DEFAULT_RESOLUTIONS ENCODER_RESOLUTION
+#else
+#define DEFAULT_RESOLUTIONS ENCODER_RESOLUTIONS
+#endif
+
+static const profile_settings_t defaultSettings PROGMEM = { 2, { DEFAULT_RESOLUTIONS } };
+
+// pages after these have no title, blank labels and every dial holds and
+// taps buttons like BUTTON_PAGE; dials after the eighth do nothing
+#define DEFAULT_PAGES (NUMBER_OF_STICKS < 5 ? NUMBER_OF_STICKS : 5)
+
+static const profile_page_t defaultPages[DEFAULT_PAGES] PROGMEM = {
+	{ // page 1: CONS/ENG/FLTI/FLOOD can be dimmers
+#if PROFILE_DEFAULT_DIMMERS
+		{ AXIS(0, 0, DIMMER_STEP), AXIS(1, 1, DIMMER_STEP), AXIS(2, 2, DIMMER_STEP), AXIS(3, 3, DIMMER_STEP),
+		  BUTTONS(4), BUTTONS(5), BUTTONS(6), BUTTONS(7) },
+#else
+		BUTTON_PAGE,
+#endif
+		"Lighting Panel",
+		{ "CONS ", "ENG  ", "FLTI ", "FLOOD", "FORM ", "NOSE ", "POS  ", "SIGNL" },
+	},
+#if NUMBER_OF_STICKS >= 2
+	{ BUTTON_PAGE, "AAP  Electrical",
+		{ "CDU  ", "EGI  ", "EmFld", " BAT ", "GenL ", "GenR ", "GenA ", "Inv  " } },
+#endif
+#if NUMBER_OF_STICKS >= 3
+	{ BUTTON_PAGE, "Fuel System",
+		{ "  BOO", "ST   ", "TkGt ", "RcvrL", "   PU", "MPS  ", "     ", "     " } },
+#endif
+#if NUMBER_OF_STICKS >= 4
+	{ BUTTON_PAGE, "AHCP",
+		{ "MArm ", "GUN  ", "Laser", " TGP ", "CICU ", "JTRS ", "IFFCC", "     " } },
+#endif
+#if NUMBER_OF_STICKS >= 5
+	{ BUTTON_PAGE, "Intercom",
+		{ "FM   ", "HF   ", "INT  ", "VHF  ", "TCN  ", "ILS  ", "AIM  ", "Vol  " } },
+#endif
+};
+
+#define eepromProfile ((profile_eeprom_t *)PROFILE_EEPROM_ADDRESS)
+
+profile_settings_t profile_settings;
+
+// slot of the newest valid save of each unit (0: settings, 1..: pages),
+// NO_SLOT while the unit uses its defaults
+#define NO_SLOT 0xff
+static uint8_t unitSlot[PROFILE_PAGES + 1];
+static uint8_t unitSequence[PROFILE_PAGES + 1];
+
+// staging buffer for profile_stage()/profile_commit(), laid out like the
+// slot it is written to
+static union {
+	profile_page_slot_t page;
+	profile_settings_slot_t settings;
+} staging;
+// unit held in the staging buffer, 0xff: none
+static uint8_t stagedPage = 0xff;
+// committed unit the staging buffer stands in for until its slot is
+// complete, 0xff: none; and the slot it goes to
+static uint8_t activePage = 0xff;
+static uint8_t activeSlot;
+static uint8_t activeSequence;
+
+// CRC of the slot in front of its crc field, the version goes in first;
+// stored little endian into those last two bytes
+static void slotCrc(uint8_t *slot, uint8_t len) {
+	uint16_t crc = _crc16_update(0xffff, PROFILE_VERSION);
+	for (uint8_t i = 0; i < len; i++)
+		crc = _crc16_update(crc, slot[i]);
+	slot[len] = crc & 0xff;
+	slot[len + 1] = crc >> 8;
+}
+
+static uint16_t eepromSlotCrc(const uint8_t *slot, uint8_t len) {
+	uint16_t crc = _crc16_update(0xffff, PROFILE_VERSION);
+	for (uint8_t i = 0; i < len; i++)
+		crc = _crc16_update(crc, eeprom_read_byte(slot + i));
+	return crc;
+}
+
+// 1 if a is a newer sequence number than b
+static uint8_t newer(uint8_t a, uint8_t b) {
+	return (int8_t)(a - b) > 0;
+}
+
+// looks at one slot at boot: a complete save of a unit, newer than the
+// one found so far?
+static void scanSlot(const uint8_t *slot, uint8_t len, uint8_t slotIndex, uint8_t firstUnit, uint8_t lastUnit) {
+	uint8_t unit = eeprom_read_byte(slot);
+	uint8_t sequence = eeprom_read_byte(slot + 1);
+	if (unit < firstUnit || unit > lastUnit) return;
+	if (eeprom_read_word((const uint16_t *)(slot + len - 2)) != eepromSlotCrc(slot, len - 2)) return;
+	if (unitSlot[unit] != NO_SLOT && !newer(sequence, unitSequence[unit])) return;
+	unitSlot[unit] = slotIndex;
+	unitSequence[unit] = sequence;
+}
+
+// 0 for a page that is neither saved nor has defaults: a button page
+static uint8_t hasPage(uint8_t page) {
+	return page == activePage || page <= DEFAULT_PAGES ||
+		(page <= PROFILE_PAGES && unitSlot[page] != NO_SLOT);
+}
+
+static void buttonPage(profile_page_t *page) {
+	memset(page, 0, sizeof(profile_page_t));
+	memset(page->labels, ' ', sizeof(page->labels));
+	for (uint8_t dial = 0; dial < NUMBER_OF_DIALS && dial < 8; dial++) {
+		page->bindings[dial].kind = BIND_BUTTONS;
+		page->bindings[dial].button = 1 + 3 * dial;
+	}
+}
+
+// page must have data, see hasPage()
+static void readPage(uint8_t page, void *dst, size_t offset, uint8_t len) {
+	if (page == activePage) {
+		memcpy(dst, (uint8_t *)&staging.page.page + offset, len);
+	} else if (page <= PROFILE_PAGES && unitSlot[page] != NO_SLOT) {
+		eeprom_read_block(dst, (const uint8_t *)&eepromProfile->pages[unitSlot[page]].page + offset, len);
+	} else {
+		memcpy_P(dst, (const uint8_t *)&defaultPages[page-1] + offset, len);
+	}
+}
+
+static void applySettings(void) {
+#ifndef ENCODER_RESOLUTION
+	for (uint8_t i = 0; i < NUMBER_OF_ENCODERS; i++)
+		encoder_set_resolution(i, profile_settings.resolution[i]);
+#endif
+}
+
+void profile_init(void) {
+	stagedPage = activePage = 0xff;
+	memset(unitSlot, NO_SLOT, sizeof(unitSlot));
+	for (uint8_t i = 0; i < 2; i++)
+		scanSlot((const uint8_t *)&eepromProfile->settings[i], sizeof(profile_settings_slot_t), i, 0, 0);
+	for (uint8_t i = 0; i < PROFILE_PAGES + 1; i++)
+		scanSlot((const uint8_t *)&eepromProfile->pages[i], sizeof(profile_page_slot_t), i, 1, PROFILE_PAGES);
+
+	if (unitSlot[0] != NO_SLOT)
+		eeprom_read_block(&profile_settings, &eepromProfile->settings[unitSlot[0]].settings, sizeof(profile_settings));
+	else
+		memcpy_P(&profile_settings, &defaultSettings, sizeof(profile_settings));
+	applySettings();
+}
+
+void profile_poll(void) {
+	if (activePage == 0xff || storage_busy()) return;
+	// the new slot is complete, the old one is free from now on
+	unitSlot[activePage] = activeSlot;
+	unitSequence[activePage] = activeSequence;
+	activePage = 0xff;
+}
+
+uint8_t profile_ready(void) {
+	return eeprom_is_ready();
+}
+
+uint8_t profile_stage_size(uint8_t page) {
+	return page ? sizeof(profile_page_t) : sizeof(profile_settings_t);
+}
+
+uint8_t *profile_stage(uint8_t page) {
+	if ((activePage != 0xff) || (page > PROFILE_PAGES) || !profile_ready()) return 0;
+	stagedPage = page;
+	if (page) {
+		if (hasPage(page))
+			readPage(page, &staging.page.page, 0, sizeof(profile_page_t));
+		else
+			buttonPage(&staging.page.page);
+		return (uint8_t *)&staging.page.page;
+	}
+	memcpy(&staging.settings.settings, &profile_settings, sizeof(profile_settings));
+	return (uint8_t *)&staging.settings.settings;
+}
+
+uint8_t profile_binding_valid(const binding_t *binding) {
+	uint8_t last = binding->button;
+	if (binding->gestures && binding->gestures + 2 > PROFILE_BUTTONS_MAX) return 0;
+	if (binding->kind == BIND_NONE) return 1;
+	if (binding->kind == BIND_BUTTONS) last += 2;
+	else if ((binding->kind & ~0x03) != BIND_AXIS) return 0;
+	return binding->button >= 1 && last <= PROFILE_BUTTONS_MAX;
+}
+
+uint8_t profile_staged_valid(void) {
+	if (stagedPage == 0xff) return 0;
+	if (stagedPage == 0) return 1; // resolutions are checked by encoder_set_resolution()
+	for (uint8_t dial = 0; dial < NUMBER_OF_DIALS; dial++)
+		if (!profile_binding_valid(&staging.page.page.bindings[dial])) return 0;
+	return 1;
+}
+
+// slot of the unit's kind that holds no unit's newest save
+static uint8_t freeSlot(uint8_t page) {
+	if (!page) return unitSlot[0] == 0 ? 1 : 0;
+	for (uint8_t slot = 0; ; slot++) {
+		uint8_t unit;
+		for (unit = 1; unit <= PROFILE_PAGES && unitSlot[unit] != slot; unit++);
+		if (unit > PROFILE_PAGES) return slot;
+	}
+}
+
+// the whole slot is one write: its bytes go out in order, so the CRC at
+// the end is the last one and the slot only becomes valid once complete
+uint8_t profile_commit(void) {
+	if (stagedPage > PROFILE_PAGES) return 1; // nothing staged (0xff)
+	uint8_t slot = freeSlot(stagedPage);
+	uint8_t sequence = unitSlot[stagedPage] == NO_SLOT ? 0 : unitSequence[stagedPage] + 1;
+	if (stagedPage) {
+		staging.page.unit = stagedPage;
+		staging.page.sequence = sequence;
+		slotCrc((uint8_t *)&staging.page, offsetof(profile_page_slot_t, crc));
+		if (!storage_write(&eepromProfile->pages[slot], &staging.page, sizeof(profile_page_slot_t), STORAGE_FROM_RAM))
+			return 0;
+	} else {
+		staging.settings.unit = 0;
+		staging.settings.sequence = sequence;
+		slotCrc((uint8_t *)&staging.settings, offsetof(profile_settings_slot_t, crc));
+		if (!storage_write(&eepromProfile->settings[slot], &staging.settings, sizeof(profile_settings_slot_t), STORAGE_FROM_RAM))
+			return 0;
+		memcpy(&profile_settings, &staging.settings.settings, sizeof(profile_settings));
+		applySettings();
+	}
+	activePage = stagedPage;
+	activeSlot = slot;
+	activeSequence = sequence;
+	stagedPage = 0xff;
+	return 1;
+}
+
+void profile_binding(uint8_t page, uint8_t dial, binding_t *binding) {
+	if (!hasPage(page)) {
+		binding->kind = dial < 8 ? BIND_BUTTONS : BIND_NONE; // 24 buttons
+		binding->button = 1 + 3 * dial;
+		binding->step[0] = binding->step[1] = 0;
+		binding->gestures = 0;
+		return;
+	}
+	readPage(page, binding, offsetof(profile_page_t, bindings[dial]), sizeof(binding_t));
+	if (!profile_binding_valid(binding)) {
+		binding->kind = BIND_NONE;
+		binding->gestures = 0;
+	}
+}
+
+// the HD44780 shows 0x00..0x07 as its CGRAM characters and has no ASCII
+// above 0x7e; such bytes from the host become spaces
+static void printable(char *text, uint8_t len) {
+	for (uint8_t i=0; i<len; i++) {
+		if ((uint8_t)text[i] < 0x20 || (uint8_t)text[i] > 0x7e) text[i] = ' ';
+	}
+}
+
+void profile_title(uint8_t page, char *dst) {
+	if (!hasPage(page))
+		dst[0] = '\0';
+	else
+		readPage(page, dst, offsetof(profile_page_t, title), PROFILE_TITLE_LENGTH);
+	dst[PROFILE_TITLE_LENGTH] = '\0';
+	printable(dst, strlen(dst));
+}
+
+void profile_label(uint8_t page, uint8_t dial, char *dst) {
+	if (!hasPage(page))
+		memset(dst, ' ', PROFILE_LABEL_LENGTH);
+	else
+		readPage(page, dst, offsetof(profile_page_t, labels[dial]), PROFILE_LABEL_LENGTH);
+	dst[PROFILE_LABEL_LENGTH] = '\0';
+	printable(dst, PROFILE_LABEL_LENGTH);
+}
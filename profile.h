@@ -0,0 +1,133 @@
+#ifndef __profile_h_included__
+#define __profile_h_included__
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "numsticks.h"
+#include "state.h"
+
+// The mapping profile: what each dial does on each page and what the
+// displays show for it. The settings and every page the host changed are
+// saved in EEPROM slots, each with a sequence number and a CRC-16 that
+// also covers PROFILE_VERSION. A unit without a valid slot uses the
+// defaults compiled into flash.
+//
+// Each unit (the settings or a page) has one slot more than it needs. A
+// save goes into the free one and the old slot stays valid until the new
+// one is complete. If the power fails during a save, only that change is
+// lost, never the rest of the profile.
+
+#define PROFILE_VERSION 4
+
+// 1: the default profile turns dials 1-4 of page 1 into dimmers on the
+// axes Rx, Ry, Rz and Slider; 0: they tap and hold buttons like all others
+#define PROFILE_DEFAULT_DIMMERS 0
+
+// binding kinds, the low nibble of BIND_AXIS holds the axis (0..3)
+#define BIND_NONE    0x00
+#define BIND_BUTTONS 0x01 // push button held as 'button', left/right tap button+1/button+2
+#define BIND_AXIS    0x10 // push button held as 'button', left/right move the axis by 'step'
+
+// bytes only, so the structs have the same layout on the host as in EEPROM
+typedef struct {
+	uint8_t kind;
+	uint8_t button;
+	uint8_t step[2]; // little endian, see BINDING_STEP()
+	uint8_t gestures; // short press, long press and double click tap gestures,
+	                  // gestures+1 and gestures+2, whatever the kind; 0: none
+} binding_t;
+
+#define BINDING_STEP(b) ((b)->step[0] | ((uint16_t)(b)->step[1] << 8))
+
+// highest button a binding may name: BIND_BUTTONS taps the two after it.
+// The default pages use all 24 for holds and taps, so their dials have no
+// gestures; a profile that gives up a dial's buttons can bind them.
+#define PROFILE_BUTTONS_MAX 24
+
+#define PROFILE_TITLE_LENGTH 16
+#define PROFILE_LABEL_LENGTH 5
+
+typedef struct {
+	binding_t bindings[NUMBER_OF_DIALS];
+	char title[PROFILE_TITLE_LENGTH];
+	char labels[NUMBER_OF_DIALS][PROFILE_LABEL_LENGTH];
+} profile_page_t;
+
+typedef struct {
+	uint8_t releaseDelay; // timer 0 overflows (13 ms) before a tapped button is released
+	uint8_t resolution[NUMBER_OF_ENCODERS]; // detents per cycle, without ENCODER_RESOLUTION
+} profile_settings_t;
+
+// sizes for the preprocessor, checked against the structs in profile.c
+#define PROFILE_BINDING_SIZE  5
+#define PROFILE_PAGE_SIZE     (NUMBER_OF_DIALS * (PROFILE_BINDING_SIZE + PROFILE_LABEL_LENGTH) + PROFILE_TITLE_LENGTH)
+#define PROFILE_SETTINGS_SIZE (1 + NUMBER_OF_ENCODERS)
+#define PROFILE_SLOT_OVERHEAD 4 // unit, sequence, CRC
+
+// pages 1..PROFILE_PAGES can be changed by the host: as many as fit in the
+// EEPROM with a spare slot, next to the settings and a full saved state.
+// The pages after them keep their defaults.
+#define PROFILE_PAGE_ROOM (E2END + 1 - 2 * (PROFILE_SETTINGS_SIZE + PROFILE_SLOT_OVERHEAD) - 1 - STATE_MAX_SIZE)
+#define PROFILE_PAGES_FIT (PROFILE_PAGE_ROOM / (PROFILE_PAGE_SIZE + PROFILE_SLOT_OVERHEAD) - 1)
+#define PROFILE_PAGES (NUMBER_OF_STICKS < PROFILE_PAGES_FIT ? NUMBER_OF_STICKS : PROFILE_PAGES_FIT)
+#if PROFILE_PAGES_FIT < 0
+#error "the EEPROM cannot hold the settings and the state"
+#endif
+
+typedef struct {
+	uint8_t unit;     // 0: settings, 1..PROFILE_PAGES: page
+	uint8_t sequence; // counts up with every save of the unit
+	profile_page_t page;
+	uint8_t crc[2];   // CRC-16 of PROFILE_VERSION and everything before it
+} profile_page_slot_t;
+
+typedef struct {
+	uint8_t unit;
+	uint8_t sequence;
+	profile_settings_t settings;
+	uint8_t crc[2];
+} profile_settings_slot_t;
+
+typedef struct {
+	profile_settings_slot_t settings[2];
+	profile_page_slot_t pages[PROFILE_PAGES + 1];
+} profile_eeprom_t;
+
+// working copy of the settings, loaded by profile_init()
+extern profile_settings_t profile_settings;
+
+// the profile lives at the start of the EEPROM
+#define PROFILE_EEPROM_ADDRESS 0
+
+// finds the newest valid slot of every unit
+void profile_init(void);
+// call from the main loop, switches to the new slot once a save is complete
+void profile_poll(void);
+// 0 while an EEPROM write is running: reading a page now would wait for it
+uint8_t profile_ready(void);
+
+// page counts from 1 like the report IDs; a binding that is not valid
+// (see profile_binding_valid()) comes back as BIND_NONE without gestures
+void profile_binding(uint8_t page, uint8_t dial, binding_t *binding);
+// kind is BIND_NONE, BIND_BUTTONS or BIND_AXIS | 0..3 and the buttons it
+// uses, gestures included, are within 1..PROFILE_BUTTONS_MAX
+uint8_t profile_binding_valid(const binding_t *binding);
+// copies the text and terminates it, dst needs one byte more than the text.
+// A title ends at its first NUL, in a label a NUL is a space like every
+// other byte outside 0x20..0x7e.
+void profile_title(uint8_t page, char *dst);
+void profile_label(uint8_t page, uint8_t dial, char *dst);
+
+// Changing the profile: profile_stage() fills a RAM buffer with the current
+// contents of a page (or of the settings for page 0) and returns it, or
+// returns 0 while the previous commit is still being written to EEPROM.
+// profile_commit() makes the staged buffer the active copy of its page in
+// one step; the page is then read from that buffer until EEPROM has caught up.
+// profile_staged_valid() checks the bindings of a staged page before that,
+// profile_commit() returns 0 if the writer's queue cannot take the page.
+uint8_t *profile_stage(uint8_t page);
+uint8_t profile_stage_size(uint8_t page);
+uint8_t profile_staged_valid(void);
+uint8_t profile_commit(void);
+
+#endif
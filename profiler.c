@@ -0,0 +1,32 @@
+#include "profiler.h"
+
+#if DIAG_PROFILER
+
+diag_hist_t profiler_stages[PROF_STAGES];
+
+static uint16_t loopStart;
+static uint16_t stageStart;
+
+void profiler_reset(void) {
+	diag_hist_reset(profiler_stages, PROF_STAGES);
+}
+
+void profiler_init(void) {
+	diag_timer_init();
+	profiler_reset();
+	loopStart = stageStart = DIAG_TICKS();
+}
+
+void profiler_start(void) {
+	uint16_t now = DIAG_TICKS();
+	diag_hist_add(&profiler_stages[PROF_LOOP], now - loopStart);
+	loopStart = stageStart = now;
+}
+
+void profiler_stage(uint8_t stage) {
+	uint16_t now = DIAG_TICKS();
+	diag_hist_add(&profiler_stages[stage], now - stageStart);
+	stageStart = now;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __profiler_h_included__
+#define __profiler_h_included__
+
+#include <stdint.h>
+#include "diag.h"
+
+// Main loop profiler: every stage of the loop is timed with Timer1 from
+// the end of the previous one, PROF_LOOP is the whole pass. The results
+// are part of the GET_STATS reply (section DIAG_PROFILER_STATS).
+
+#define PROF_SPI          0 // shift register snapshot
+#define PROF_DECODE       1 // encoder_events() and gestures
+#define PROF_INPUT        2 // handleInput(), includes selectPage()
+#define PROF_USB          3 // usbPoll()
+#define PROF_HOUSEKEEPING 4 // EEPROM, config, displays, state, release timer
+#define PROF_REPORT       5 // usbSetInterrupt()
+#define PROF_LOOP         6
+#define PROF_STAGES       7
+
+#if DIAG_PROFILER
+
+extern diag_hist_t profiler_stages[PROF_STAGES];
+
+void profiler_init(void);
+void profiler_reset(void);
+// marks the start of a loop pass
+void profiler_start(void);
+// marks the end of a stage
+void profiler_stage(uint8_t stage);
+
+#define PROFILE_START()  profiler_start()
+#define PROFILE_STAGE(s) profiler_stage(s)
+
+#else
+
+#define PROFILE_START()
+#define PROFILE_STAGE(s)
+
+#endif
+
+#endif
@@ -0,0 +1,288 @@
+// Benchmark under simavr: turns the dials at increasing speed, first only
+// encoder 0, then all dials of a page at once, and measures
+//  - the fastest rate without lost steps: every quadrature transition
+//    counted as valid in encoder_stats, none as illegal
+//  - cycles from the transition that completes a detent to the next
+//    report handed to the endpoint (usbSetInterrupt)
+//  - the longest gap between two usbPoll() calls
+// Results can be written as "key value" lines (-o) and compared against
+// such a file (-b), failing when a value got worse by more than -t %.
+// Without that file the results are only reported.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "parts.h"
+#include "../encoder.h"
+
+#define INTERVAL_MS 10       // USB_CFG_INTR_POLL_INTERVAL
+#define ENCODERS NUMBER_OF_ENCODERS
+#define DIALS NUMBER_OF_DIALS  // the page selector is left alone
+#define DETENTS_PER_REV 24
+#define DETENTS 24           // per direction and level
+#define SETTLE_MS 60         // after a level: releases and the last report
+#define UNANSWERED_MS 100    // no report this long after a detent: not counted
+#define MAX_PENDING (8 * DETENTS * DIALS)
+#define HIST_BUCKETS 24
+
+static const unsigned int rpms[] = { 15, 30, 60, 120, 240, 480, 960, 1920, 3840 };
+#define LEVELS (sizeof(rpms) / sizeof(rpms[0]))
+
+// quarter steps turning right, see encoder.h: N W S E
+static const uint8_t quadrature[4] = { ECST_NORTH, ECST_WEST, ECST_SOUTH, ECST_EAST };
+// their positions along NORTH -> EAST -> SOUTH -> WEST, as encoder.c counts
+static const uint8_t position[4] = { 0, 3, 2, 1 };
+
+// the positions the firmware emits a step on, with its default resolutions
+#ifdef ENCODER_RESOLUTION
+#define detents(dial) ENCODER_DETENT_MASK(ENCODER_RESOLUTION)
+#else
+static const uint8_t resolutions[ENCODERS] = { ENCODER_RESOLUTIONS };
+#define detents(dial) ENCODER_DETENT_MASK(resolutions[dial])
+#endif
+
+static uint16_t statsAddress;
+
+static avr_cycle_count_t pending[MAX_PENDING];
+static int pendingCount;
+static avr_cycle_count_t *samples;
+static unsigned long sampleCount, unanswered;
+static avr_cycle_count_t cyclesPerMs;
+
+static void reportSent(avr_t *avr, const uint8_t *data, uint8_t len) {
+	for (int i = 0; i < pendingCount; i++) {
+		avr_cycle_count_t delay = avr->cycle - pending[i];
+		if (delay > UNANSWERED_MS * cyclesPerMs) {
+			unanswered++;
+			continue;
+		}
+		samples = realloc(samples, (sampleCount + 1) * sizeof(*samples));
+		samples[sampleCount++] = delay;
+	}
+	pendingCount = 0;
+}
+
+static void runUntil(avr_t *avr, avr_cycle_count_t until, int *state) {
+	while (avr->cycle < until && *state != cpu_Done && *state != cpu_Crashed)
+		*state = avr_run(avr);
+}
+
+static encoder_stats_t readStats(avr_t *avr, uint8_t encoder) {
+	encoder_stats_t stats;
+	memcpy(&stats, avr->data + statsAddress + encoder * sizeof(stats), sizeof(stats));
+	return stats;
+}
+
+static int compareCycles(const void *a, const void *b) {
+	avr_cycle_count_t x = *(const avr_cycle_count_t *)a, y = *(const avr_cycle_count_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+typedef struct {
+	unsigned int losslessRpm;
+	avr_cycle_count_t p50, p90, p99, max;
+	avr_cycle_count_t pollGap;
+	avr_cycle_count_t scanMax;
+} result_t;
+
+// one mode: the levels in turn, each DETENTS right and DETENTS back left
+static int runMode(avr_t *avr, const char *name, uint8_t dials, result_t *result, int *state) {
+	double us = 1e6 / avr->frequency;
+	int lossless = 1;
+
+	memset(result, 0, sizeof(*result));
+	sampleCount = unanswered = 0;
+	pendingCount = 0;
+	usb_capture_reset_poll_stats();
+	hc165_reset_scan_stats();
+
+	printf("%s: %u dial%s, %u detents per revolution\n", name, dials, dials > 1 ? "s" : "", DETENTS_PER_REV);
+	printf("  %6s %8s %10s %8s %8s\n", "rpm", "detent/s", "transits", "illegal", "lost");
+	for (unsigned int level = 0; level < LEVELS; level++) {
+		double detentsPerSecond = rpms[level] * (double)DETENTS_PER_REV / 60;
+		avr_cycle_count_t quarter = avr->frequency / (detentsPerSecond * 4);
+
+		memset(avr->data + statsAddress, 0, ENCODERS * sizeof(encoder_stats_t));
+		avr_cycle_count_t edge = avr->cycle;
+		for (int step = 0; step < 8 * DETENTS; step++) {
+			edge += quarter;
+			runUntil(avr, edge, state);
+			int right = step < 4 * DETENTS;
+			uint8_t phase = right ? (step + 1) % 4 : (4 - (step + 1) % 4) % 4;
+			for (uint8_t dial = 0; dial < dials; dial++) {
+				hc165_set_encoder(dial, quadrature[phase] | ECST_STATEMASK_BUTTONSTATE);
+				// this transition completes a detent: the latency starts here
+				if ((detents(dial) & (1 << position[phase])) && pendingCount < MAX_PENDING)
+					pending[pendingCount++] = avr->cycle;
+			}
+		}
+		runUntil(avr, avr->cycle + SETTLE_MS * cyclesPerMs, state);
+		if (*state == cpu_Crashed) return 0;
+
+		unsigned long valid = 0, illegal = 0;
+		for (uint8_t dial = 0; dial < dials; dial++) {
+			encoder_stats_t stats = readStats(avr, dial);
+			valid += stats.valid;
+			illegal += stats.illegal;
+		}
+		unsigned long expected = 8UL * DETENTS * dials;
+		long lost = expected - valid;
+		printf("  %6u %8.0f %10lu %8lu %8ld\n", rpms[level], detentsPerSecond, valid, illegal, lost);
+		if (lost || illegal) lossless = 0;
+		if (lossless) result->losslessRpm = rpms[level];
+	}
+
+	if (sampleCount) {
+		qsort(samples, sampleCount, sizeof(*samples), compareCycles);
+		result->p50 = samples[sampleCount / 2];
+		result->p90 = samples[sampleCount * 9 / 10];
+		result->p99 = samples[sampleCount * 99 / 100];
+		result->max = samples[sampleCount - 1];
+
+		// log2 histogram of the detent to report cycles
+		unsigned long buckets[HIST_BUCKETS] = { 0 };
+		for (unsigned long i = 0; i < sampleCount; i++) {
+			int b = 0;
+			while (b < HIST_BUCKETS - 1 && samples[i] >= (2ULL << b)) b++;
+			buckets[b]++;
+		}
+		printf("  detent to report, %lu samples (%lu unanswered):\n", sampleCount, unanswered);
+		for (int b = 0; b < HIST_BUCKETS; b++) {
+			if (!buckets[b]) continue;
+			printf("    < %9llu cycles %8.1f us %7lu\n", 2ULL << b, (2ULL << b) * us, buckets[b]);
+		}
+		printf("  p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+			result->p50 * us, result->p90 * us, result->p99 * us, result->max * us);
+	}
+
+	unsigned long polls, scans;
+	avr_cycle_count_t min, total;
+	usb_capture_poll_stats(&polls, &result->pollGap);
+	hc165_scan_stats(&scans, &min, &result->scanMax, &total);
+	printf("  usbPoll() gap max %.1f us, scan period max %.1f us\n", result->pollGap * us, result->scanMax * us);
+	if (result->losslessRpm)
+		printf("  lossless up to %u rpm (%.0f detents/s)\n\n", result->losslessRpm,
+			result->losslessRpm * (double)DETENTS_PER_REV / 60);
+	else
+		printf("  steps lost even at %u rpm\n\n", rpms[0]);
+	return 1;
+}
+
+typedef struct {
+	char key[48];
+	double value;
+} entry_t;
+
+static int addResults(entry_t *entries, int n, const char *mode, const result_t *r, double us) {
+	const struct { const char *name; double value; } values[] = {
+		{ "lossless_rpm", r->losslessRpm },
+		{ "latency_p50_us", r->p50 * us },
+		{ "latency_p90_us", r->p90 * us },
+		{ "latency_p99_us", r->p99 * us },
+		{ "latency_max_us", r->max * us },
+		{ "poll_gap_us", r->pollGap * us },
+		{ "scan_period_us", r->scanMax * us },
+	};
+	for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		snprintf(entries[n].key, sizeof(entries[n].key), "%s.%s", mode, values[i].name);
+		entries[n++].value = values[i].value;
+	}
+	return n;
+}
+
+// rates are better when higher, times when lower
+static int compareBaseline(const char *name, const entry_t *entries, int n, double tolerance) {
+	FILE *f = fopen(name, "r");
+	if (!f) {
+		printf("no baseline %s to compare with, make bench-baseline records one\n", name);
+		return 1;
+	}
+	char line[128], key[48];
+	double old;
+	int ok = 1;
+	printf("%-28s %10s %10s %8s\n", "against baseline", "was", "now", "change");
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%47s %lf", key, &old) != 2) continue;
+		int i;
+		for (i = 0; i < n && strcmp(entries[i].key, key); i++);
+		if (i == n) {
+			printf("%-28s %10.1f %10s\n", key, old, "-");
+			continue;
+		}
+		double now = entries[i].value;
+		double change = old ? (now - old) * 100 / old : 0;
+		int higherIsBetter = strstr(key, "rpm") != NULL;
+		int worse = higherIsBetter ? change < -tolerance : change > tolerance;
+		printf("%-28s %10.1f %10.1f %+7.1f%%%s\n", key, old, now, change, worse ? "  WORSE" : "");
+		if (worse) ok = 0;
+	}
+	fclose(f);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	const char *firmware = "sim/main-sim.bin";
+	const char *symbols = "sim/main-sim.sym";
+	const char *baseline = NULL;
+	const char *output = NULL;
+	double tolerance = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:s:b:o:t:")) != -1) {
+		switch (opt) {
+			case 'f': firmware = optarg; break;
+			case 's': symbols = optarg; break;
+			case 'b': baseline = optarg; break;
+			case 'o': output = optarg; break;
+			case 't': tolerance = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-f firmware.bin] [-s symbols] [-b baseline] [-o results] [-t tolerance %%]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	statsAddress = sim_symbol(symbols, "encoder_stats");
+	if (!statsAddress) {
+		fprintf(stderr, "%s: no encoder_stats\n", symbols);
+		return 1;
+	}
+	avr_t *avr = sim_load(firmware);
+	if (!avr) return 1;
+	cyclesPerMs = avr->frequency / 1000;
+
+	static hd44780_t lcd1, lcd2;
+	hc165_init(avr);
+	hd44780_init(&lcd1, avr, 'C');
+	hd44780_init(&lcd2, avr, 'D');
+	usb_capture_init(avr, INTERVAL_MS, NULL);
+	usb_capture_on_send(reportSent);
+	for (uint8_t i = 0; i < ENCODERS; i++) hc165_set_encoder(i, 7);
+
+	// boot: displays, settings and the first reports
+	int state = cpu_Running;
+	runUntil(avr, 500 * cyclesPerMs, &state);
+
+	result_t one, all;
+	if (!runMode(avr, "one", 1, &one, &state) || !runMode(avr, "all", DIALS, &all, &state)) {
+		fprintf(stderr, "firmware crashed at %.3f ms\n", avr->cycle * 1000.0 / avr->frequency);
+		return 1;
+	}
+
+	double us = 1e6 / avr->frequency;
+	entry_t entries[32];
+	int n = addResults(entries, 0, "one", &one, us);
+	n = addResults(entries, n, "all", &all, us);
+
+	if (output) {
+		FILE *f = fopen(output, "w");
+		if (!f) {
+			perror(output);
+			return 1;
+		}
+		fprintf(f, "# sim/avrbench results, compared by make bench\n");
+		for (int i = 0; i < n; i++) fprintf(f, "%s %.1f\n", entries[i].key, entries[i].value);
+		fclose(f);
+	}
+	if (baseline && !compareBaseline(baseline, entries, n, tolerance)) return 2;
+	return 0;
+}
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include "parts.h"
+
+// Follows the call stack instruction by instruction, from the opcodes
+// in flash and the function ranges of a checkpoll map, and charges the
+// cycles to call paths. A window runs from one mark to the next; the
+// paths of the longest window are kept.
+
+#define VECTORS_END 0x68   // ATmega168: 26 vectors of 4 bytes
+#define MAX_DEPTH 32
+
+typedef struct {
+	uint32_t start, end;
+	char *name;
+} function_t;
+
+typedef struct {
+	int parent;
+	int function;
+} path_t;
+
+static function_t *functions;
+static int functionCount;
+static path_t *paths;
+static int pathCount;
+
+static int stack[MAX_DEPTH];
+static int depth;
+
+struct callstack_window {
+	avr_cycle_count_t start;
+	avr_cycle_count_t *cycles;        // by path, this window
+	int *touched, touchedCount;
+	avr_cycle_count_t longest, longestAt;
+	avr_cycle_count_t *longestCycles; // by path, the longest window
+	int *longestTouched, longestTouchedCount;
+	int marks;
+};
+
+static callstack_window_t *windows[2];
+static int windowCount;
+
+// checkpoll map lines: <start> <end> <name>, byte addresses in hex
+int callstack_load(const char *map) {
+	FILE *f = fopen(map, "r");
+	if (!f) {
+		perror(map);
+		return 0;
+	}
+	char line[256], name[128];
+	unsigned long start, end;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx %lx %127s", &start, &end, name) != 3) continue;
+		functions = realloc(functions, (functionCount + 1) * sizeof(function_t));
+		functions[functionCount].start = start;
+		functions[functionCount].end = end;
+		functions[functionCount++].name = strdup(name);
+	}
+	fclose(f);
+	// the root path: whatever runs before the first call
+	paths = malloc(sizeof(path_t));
+	paths[0].parent = -1;
+	paths[0].function = -1;
+	pathCount = 1;
+	stack[0] = 0;
+	depth = 1;
+	return functionCount > 0;
+}
+
+// map lines come sorted by address
+static int functionAt(uint32_t pc) {
+	int lo = 0, hi = functionCount - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (pc < functions[mid].start) hi = mid - 1;
+		else if (pc >= functions[mid].end) lo = mid + 1;
+		else return mid;
+	}
+	return -1;
+}
+
+static int pathTo(int parent, int function) {
+	for (int i = 0; i < pathCount; i++)
+		if (paths[i].parent == parent && paths[i].function == function) return i;
+	paths = realloc(paths, (pathCount + 1) * sizeof(path_t));
+	paths[pathCount].parent = parent;
+	paths[pathCount].function = function;
+	for (int w = 0; w < windowCount; w++) {
+		callstack_window_t *window = windows[w];
+		window->cycles = realloc(window->cycles, (pathCount + 1) * sizeof(avr_cycle_count_t));
+		window->cycles[pathCount] = 0;
+		window->touched = realloc(window->touched, (pathCount + 1) * sizeof(int));
+		window->longestCycles = realloc(window->longestCycles, (pathCount + 1) * sizeof(avr_cycle_count_t));
+		window->longestTouched = realloc(window->longestTouched, (pathCount + 1) * sizeof(int));
+	}
+	return pathCount++;
+}
+
+callstack_window_t *callstack_window(void) {
+	callstack_window_t *window = calloc(1, sizeof(callstack_window_t));
+	window->cycles = calloc(pathCount, sizeof(avr_cycle_count_t));
+	window->touched = malloc(pathCount * sizeof(int));
+	window->longestCycles = malloc(pathCount * sizeof(avr_cycle_count_t));
+	window->longestTouched = malloc(pathCount * sizeof(int));
+	windows[windowCount++] = window;
+	return window;
+}
+
+static void charge(callstack_window_t *window, int path, avr_cycle_count_t cycles) {
+	if (!window->cycles[path]) window->touched[window->touchedCount++] = path;
+	window->cycles[path] += cycles;
+}
+
+void callstack_mark(callstack_window_t *window, avr_t *avr) {
+	avr_cycle_count_t length = avr->cycle - window->start;
+	if (window->marks++ && length > window->longest) {
+		window->longest = length;
+		window->longestAt = avr->cycle;
+		window->longestTouchedCount = window->touchedCount;
+		for (int i = 0; i < window->touchedCount; i++) {
+			int path = window->touched[i];
+			window->longestTouched[i] = path;
+			window->longestCycles[path] = window->cycles[path];
+		}
+	}
+	for (int i = 0; i < window->touchedCount; i++) window->cycles[window->touched[i]] = 0;
+	window->touchedCount = 0;
+	window->start = avr->cycle;
+}
+
+static uint16_t opcode(avr_t *avr, uint32_t pc) {
+	return avr->flash[pc] | avr->flash[pc + 1] << 8;
+}
+
+int callstack_step(avr_t *avr) {
+	uint32_t pc = avr->pc;
+	avr_cycle_count_t before = avr->cycle;
+	uint16_t op = opcode(avr, pc);
+	// rcall .+0 only pushes to reserve stack space for locals, it is no call
+	int isCall = ((op & 0xf000) == 0xd000 && op != 0xd000) || (op & 0xfe0e) == 0x940e || op == 0x9509 || op == 0x9519;
+	int isReturn = op == 0x9508 || op == 0x9518;
+
+	int state = avr_run(avr);
+
+	for (int w = 0; w < windowCount; w++) charge(windows[w], stack[depth - 1], avr->cycle - before);
+
+	int function = functionAt(avr->pc);
+	int top = paths[stack[depth - 1]].function;
+	if (avr->pc < VECTORS_END && (top < 0 || avr->pc < functions[top].start || avr->pc >= functions[top].end)) {
+		// interrupt taken, possibly right after a call or return
+		if (isReturn && depth > 1) depth--;
+		if (depth < MAX_DEPTH) { stack[depth] = pathTo(stack[depth - 1], function); depth++; }
+	} else if (isCall) {
+		if (depth < MAX_DEPTH) { stack[depth] = pathTo(stack[depth - 1], function); depth++; }
+	} else if (isReturn) {
+		if (depth > 1) depth--;
+	} else if (function != top && function >= 0) {
+		// tail jump or fall through into the next function: same depth
+		stack[depth - 1] = pathTo(depth > 1 ? stack[depth - 2] : -1, function);
+	}
+	return state;
+}
+
+static void pathName(int path, char *text, size_t size) {
+	if (path <= 0 || paths[path].function < 0) {
+		snprintf(text, size, "-");
+		return;
+	}
+	char parent[512];
+	if (paths[path].parent > 0) {
+		pathName(paths[path].parent, parent, sizeof(parent));
+		snprintf(text, size, "%s>%s", parent, functions[paths[path].function].name);
+	} else {
+		snprintf(text, size, "%s", functions[paths[path].function].name);
+	}
+}
+
+static int compareCycles(const void *a, const void *b) {
+	avr_cycle_count_t x = *(const avr_cycle_count_t *)a >> 16, y = *(const avr_cycle_count_t *)b >> 16;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+avr_cycle_count_t callstack_longest(callstack_window_t *window, avr_cycle_count_t *at) {
+	if (at) *at = window->longestAt;
+	return window->longest;
+}
+
+// the paths of the longest window, most cycles first
+void callstack_print(callstack_window_t *window, avr_t *avr, int lines, FILE *out) {
+	double us = 1e6 / avr->frequency;
+	int n = window->longestTouchedCount;
+	// cycles in the upper bits, path in the lower 16 for sorting
+	avr_cycle_count_t *sorted = malloc(n * sizeof(avr_cycle_count_t));
+	for (int i = 0; i < n; i++) {
+		int path = window->longestTouched[i];
+		sorted[i] = window->longestCycles[path] << 16 | path;
+	}
+	qsort(sorted, n, sizeof(avr_cycle_count_t), compareCycles);
+	char name[512];
+	for (int i = 0; i < n && i < lines; i++) {
+		pathName(sorted[i] & 0xffff, name, sizeof(name));
+		fprintf(out, "  %9llu cycles %9.1f us  %s\n", (unsigned long long)(sorted[i] >> 16),
+			(sorted[i] >> 16) * us, name);
+	}
+	free(sorted);
+}
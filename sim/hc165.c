@@ -0,0 +1,67 @@
+#include <string.h>
+#include "parts.h"
+#include "avr_ioport.h"
+#include "avr_spi.h"
+
+static uint8_t inputs[CHAIN_BYTES];
+static uint8_t latched[CHAIN_BYTES];
+static uint8_t position;
+static avr_irq_t *spiInput;
+
+static unsigned long scans;
+static avr_cycle_count_t lastLatch, minPeriod = ~0ULL, maxPeriod, totalPeriod;
+
+static void loadChanged(struct avr_irq_t *irq, uint32_t value, void *param) {
+	avr_t *avr = param;
+	if (!value) return;
+	memcpy(latched, inputs, CHAIN_BYTES);
+	position = 0;
+
+	if (scans++) {
+		avr_cycle_count_t period = avr->cycle - lastLatch;
+		if (period < minPeriod) minPeriod = period;
+		if (period > maxPeriod) maxPeriod = period;
+		totalPeriod += period;
+	}
+	lastLatch = avr->cycle;
+}
+
+static void spiOutput(struct avr_irq_t *irq, uint32_t value, void *param) {
+	avr_raise_irq(spiInput, position < CHAIN_BYTES ? latched[position] : 0);
+	position++;
+}
+
+void hc165_init(avr_t *avr) {
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 2), loadChanged, avr);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT), spiOutput, avr);
+	spiInput = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+}
+
+void hc165_set_chain(const uint8_t *chain) {
+	memcpy(inputs, chain, CHAIN_BYTES);
+}
+
+void hc165_set_encoder(uint8_t encoder, uint8_t state) {
+	for (uint8_t k = 0; k < 3; k++) {
+		uint8_t pos = ENCODER_CHAIN_BIT(encoder) + k;
+		if (pos >= 8 * CHAIN_BYTES) return;
+		uint8_t bit = 0x80 >> (pos % 8);
+		if (state & (4 >> k))
+			inputs[pos / 8] |= bit;
+		else
+			inputs[pos / 8] &= ~bit;
+	}
+}
+
+void hc165_reset_scan_stats(void) {
+	scans = 0;
+	minPeriod = ~0ULL;
+	maxPeriod = totalPeriod = 0;
+}
+
+void hc165_scan_stats(unsigned long *count, avr_cycle_count_t *min, avr_cycle_count_t *max, avr_cycle_count_t *total) {
+	*count = scans;
+	*min = minPeriod;
+	*max = maxPeriod;
+	*total = totalPeriod;
+}
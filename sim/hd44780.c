@@ -0,0 +1,73 @@
+#include <string.h>
+#include "parts.h"
+#include "avr_ioport.h"
+
+// the wiring from lcd-routines.h
+static const uint8_t pinsC[6] = { 0, 1, 2, 3, 4, 5 }; // DB4..DB7, RS, EN
+static const uint8_t pinsD[6] = { 5, 7, 6, 1, 0, 4 };
+
+static void command(hd44780_t *lcd, uint8_t c) {
+	if (c & 0x80) {
+		lcd->address = c & 0x7f;
+		lcd->cgram = 0;
+	} else if (c & 0x40) {
+		lcd->cgram = 1;
+	} else if (c & 0x20) {
+		lcd->fourBit = !(c & 0x10);
+		lcd->nibble = 0;
+	} else if (c & 0x02) {
+		lcd->address = 0;
+		lcd->cgram = 0;
+	} else if (c & 0x01) {
+		memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+		lcd->address = 0;
+		lcd->cgram = 0;
+	}
+}
+
+static void transfer(hd44780_t *lcd, uint8_t rs, uint8_t byte) {
+	if (!rs) {
+		command(lcd, byte);
+	} else if (!lcd->cgram) {
+		lcd->ddram[lcd->address] = byte;
+		lcd->address = (lcd->address + 1) & 0x7f;
+	}
+}
+
+static void portChanged(struct avr_irq_t *irq, uint32_t value, void *param) {
+	hd44780_t *lcd = param;
+	uint8_t falling = (lcd->port & (1 << lcd->en)) && !(value & (1 << lcd->en));
+	lcd->port = value;
+	if (!falling) return;
+
+	uint8_t nibble = 0;
+	for (uint8_t i = 0; i < 4; i++)
+		if (value & (1 << lcd->data[i])) nibble |= 1 << i;
+	uint8_t rs = (value >> lcd->rs) & 1;
+
+	if (!lcd->fourBit) {
+		// 8 bit mode, DB0..DB3 are not connected
+		transfer(lcd, rs, nibble << 4);
+	} else if (!lcd->nibble) {
+		lcd->high = nibble;
+		lcd->nibble = 1;
+	} else {
+		lcd->nibble = 0;
+		transfer(lcd, rs, (lcd->high << 4) | nibble);
+	}
+}
+
+void hd44780_init(hd44780_t *lcd, avr_t *avr, char port) {
+	const uint8_t *pins = port == 'C' ? pinsC : pinsD;
+	memset(lcd, 0, sizeof(*lcd));
+	memcpy(lcd->data, pins, 4);
+	lcd->rs = pins[4];
+	lcd->en = pins[5];
+	memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), IOPORT_IRQ_PIN_ALL), portChanged, lcd);
+}
+
+void hd44780_row(hd44780_t *lcd, uint8_t row, char *text) {
+	memcpy(text, &lcd->ddram[row == 2 ? 0x40 : 0x00], 20);
+	text[20] = 0;
+}
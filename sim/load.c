@@ -0,0 +1,41 @@
+#include <stdlib.h>
+#include <string.h>
+#include "parts.h"
+#include "sim_elf.h"
+
+avr_t *sim_load(const char *firmware) {
+	elf_firmware_t f;
+	memset(&f, 0, sizeof(f));
+	if (elf_read_firmware(firmware, &f)) {
+		fprintf(stderr, "%s: can not read firmware\n", firmware);
+		return NULL;
+	}
+	strcpy(f.mmcu, "atmega168");
+	f.frequency = 20000000;
+
+	avr_t *avr = avr_make_mcu_by_name(f.mmcu);
+	if (!avr) return NULL;
+	avr_init(avr);
+	avr_load_firmware(avr, &f);
+	return avr;
+}
+
+// avr-nm lines: "00800123 B encoder_stats", RAM starts at 0x800000
+uint16_t sim_symbol(const char *listing, const char *name) {
+	FILE *f = fopen(listing, "r");
+	if (!f) {
+		perror(listing);
+		return 0;
+	}
+	char line[256], symbol[128], type[4];
+	unsigned long address;
+	uint16_t result = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx %3s %127s", &address, type, symbol) == 3 && !strcmp(symbol, name)) {
+			result = address & 0xffff;
+			break;
+		}
+	}
+	fclose(f);
+	return result;
+}
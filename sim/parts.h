@@ -0,0 +1,64 @@
+#ifndef __parts_h_included__
+#define __parts_h_included__
+
+// Virtual peripherals around the simulated ATmega168 (see sim.c)
+
+#include <stdio.h>
+#include <stdint.h>
+#include "sim_avr.h"
+#include "../numsticks.h" // chain layout and encoder count
+
+// 74HC165 chain: PB2 high latches the inputs, every byte the AVR shifts
+// out on SPI returns the next chain byte
+void hc165_init(avr_t *avr);
+void hc165_set_chain(const uint8_t *chain);
+// three bits from ENCODER_CHAIN_BIT(encoder) on
+void hc165_set_encoder(uint8_t encoder, uint8_t state);
+// latches so far and the spacing between them in cycles
+void hc165_scan_stats(unsigned long *scans, avr_cycle_count_t *min, avr_cycle_count_t *max, avr_cycle_count_t *total);
+void hc165_reset_scan_stats(void);
+
+// HD44780 in 4 bit mode on one port: data bits DB4..DB7, RS and EN pins
+typedef struct {
+	uint8_t data[4];
+	uint8_t rs;
+	uint8_t en;
+	uint8_t port;       // last value written to the port
+	uint8_t fourBit;    // after function set with DL = 0
+	uint8_t nibble;     // high nibble received, waiting for the low one
+	uint8_t high;
+	uint8_t cgram;      // data goes to the character generator
+	uint8_t address;
+	char ddram[0x80];
+} hd44780_t;
+
+void hd44780_init(hd44780_t *lcd, avr_t *avr, char port);
+// text of row 1 or 2, 20 characters
+void hd44780_row(hd44780_t *lcd, uint8_t row, char *text);
+
+// stand-in for the USB interrupt endpoint, see HAL_SIM in hal.h. The
+// endpoint is free again intervalMs after a report.
+typedef void (*usb_capture_fn)(avr_t *avr, const uint8_t *data, uint8_t len);
+void usb_capture_init(avr_t *avr, uint8_t intervalMs, FILE *out);
+void usb_capture_on_send(usb_capture_fn fn);
+unsigned long usb_capture_count(void);
+// usbPoll() calls and the longest gap between two of them in cycles
+void usb_capture_poll_stats(unsigned long *count, avr_cycle_count_t *maxGap);
+void usb_capture_reset_poll_stats(void);
+
+// call paths by cycles between marks, for the longest window (see checkpoll)
+typedef struct callstack_window callstack_window_t;
+int callstack_load(const char *map);
+callstack_window_t *callstack_window(void);
+// avr_run() for one instruction, following calls and returns
+int callstack_step(avr_t *avr);
+void callstack_mark(callstack_window_t *window, avr_t *avr);
+avr_cycle_count_t callstack_longest(callstack_window_t *window, avr_cycle_count_t *at);
+void callstack_print(callstack_window_t *window, avr_t *avr, int lines, FILE *out);
+
+// loads an ELF firmware into a new ATmega168 at 20MHz
+avr_t *sim_load(const char *firmware);
+// data space address of a variable, from an avr-nm listing; 0 if unknown
+uint16_t sim_symbol(const char *listing, const char *name);
+
+#endif
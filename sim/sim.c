@@ -0,0 +1,212 @@
+// Runs the firmware under simavr with the panel around it: the shift
+// register chain driven from a script, both displays and the interrupt
+// endpoint stand-in. Captured reports go to stdout, followed by the
+// screens and the scan timing.
+//
+// With a checkpoll map (-m, see checkpoll) it follows the call stack and
+// prints where the cycles of the longest usbPoll() interval and of the
+// longest scan interval went; -P and -S set budgets in us for them, the
+// exit status is 3 when one is exceeded.
+//
+// script lines, times in ms since reset (fractions allowed), '#' starts
+// a comment; host/golden/*.rec recordings are scripts as well:
+//   <ms> enc <encoder> <state>        3 bit state of an encoder (see encoder.h)
+//   <ms> chain <b0> <b1> <b2> <b3>    raw chain bytes, CHAIN_BYTES of them
+//   <ms> end                          stop the simulation
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "parts.h"
+
+#define INTERVAL_MS 10 // USB_CFG_INTR_POLL_INTERVAL
+
+typedef struct {
+	double ms;
+	int kind;  // 0 encoder, 1 chain, 2 end
+	uint8_t values[CHAIN_BYTES];
+} step_t;
+
+static step_t *steps;
+static int stepCount;
+
+// numbers after the keyword, -1 if there are more than max
+static int readValues(const char *text, unsigned int *v, int max) {
+	int n = 0;
+	for (;;) {
+		char *end;
+		unsigned long value = strtoul(text, &end, 0);
+		if (end == text) return n;
+		if (n == max) return -1;
+		v[n++] = value;
+		text = end;
+	}
+}
+
+static int readScript(const char *name) {
+	FILE *f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		return 0;
+	}
+	char line[256];
+	int lineNumber = 0;
+	while (fgets(line, sizeof(line), f)) {
+		lineNumber++;
+		char *comment = strchr(line, '#');
+		if (comment) *comment = 0;
+		char word[16];
+		double ms;
+		unsigned int v[CHAIN_BYTES];
+		int pos;
+		step_t step;
+		memset(&step, 0, sizeof(step));
+		if (sscanf(line, "%lf %15s%n", &ms, word, &pos) < 2) {
+			if (sscanf(line, "%15s", word) <= 0) continue;
+			fprintf(stderr, "%s:%d: bad line\n", name, lineNumber);
+			fclose(f);
+			return 0;
+		}
+		int n = readValues(line + pos, v, CHAIN_BYTES);
+		step.ms = ms;
+		if (n == 2 && !strcmp(word, "enc")) {
+			step.kind = 0;
+			step.values[0] = v[0];
+			step.values[1] = v[1];
+		} else if (n == CHAIN_BYTES && !strcmp(word, "chain")) {
+			step.kind = 1;
+			for (int i = 0; i < CHAIN_BYTES; i++) step.values[i] = v[i];
+		} else if (n == 0 && !strcmp(word, "end")) {
+			step.kind = 2;
+		} else {
+			fprintf(stderr, "%s:%d: bad line\n", name, lineNumber);
+			fclose(f);
+			return 0;
+		}
+		steps = realloc(steps, (stepCount + 1) * sizeof(step_t));
+		steps[stepCount++] = step;
+	}
+	fclose(f);
+	return 1;
+}
+
+static unsigned long pollCount(void) {
+	unsigned long polls;
+	avr_cycle_count_t gap;
+	usb_capture_poll_stats(&polls, &gap);
+	return polls;
+}
+
+static unsigned long scanCount(void) {
+	unsigned long scans;
+	avr_cycle_count_t min, max, total;
+	hc165_scan_stats(&scans, &min, &max, &total);
+	return scans;
+}
+
+// the longest interval and its call paths; 1 when over the budget
+static int printWindow(const char *name, callstack_window_t *window, avr_t *avr, double budget) {
+	avr_cycle_count_t at;
+	double us = callstack_longest(window, &at) * 1e6 / avr->frequency;
+	int over = budget > 0 && us > budget;
+	printf("\nlongest %s interval: %.1f us, ending at %.3f ms", name, us, at * 1000.0 / avr->frequency);
+	if (budget > 0) printf(over ? ", *** over the budget of %.0f us" : ", budget %.0f us", budget);
+	printf("\n");
+	callstack_print(window, avr, 12, stdout);
+	return over;
+}
+
+int main(int argc, char **argv) {
+	const char *firmware = "sim/main-sim.bin";
+	const char *map = NULL;
+	double pollBudget = 0, scanBudget = 0;
+	int quiet = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:qm:P:S:")) != -1) {
+		switch (opt) {
+			case 'f': firmware = optarg; break;
+			case 'q': quiet = 1; break;
+			case 'm': map = optarg; break;
+			case 'P': pollBudget = atof(optarg); break;
+			case 'S': scanBudget = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-f firmware.bin] [-q] [-m map [-P poll us] [-S scan us]] script\n", argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc || !readScript(argv[optind])) return 1;
+
+	avr_t *avr = sim_load(firmware);
+	if (!avr) return 1;
+	callstack_window_t *pollWindow = NULL, *scanWindow = NULL;
+	if (map) {
+		if (!callstack_load(map)) return 1;
+		pollWindow = callstack_window();
+		scanWindow = callstack_window();
+	}
+
+	static hd44780_t lcd1, lcd2;
+	hc165_init(avr);
+	hd44780_init(&lcd1, avr, 'C');
+	hd44780_init(&lcd2, avr, 'D');
+	usb_capture_init(avr, INTERVAL_MS, quiet ? NULL : stdout);
+
+	// everything resting: quadrature north, buttons released
+	for (uint8_t i = 0; i < NUMBER_OF_ENCODERS; i++) hc165_set_encoder(i, 7);
+
+	int next = 0;
+	int state = cpu_Running;
+	avr_cycle_count_t cyclesPerMs = avr->frequency / 1000;
+	while (state != cpu_Done && state != cpu_Crashed) {
+		double ms = (double)avr->cycle / cyclesPerMs;
+		while (next < stepCount && steps[next].ms <= ms) {
+			step_t *step = &steps[next++];
+			if (step->kind == 0) hc165_set_encoder(step->values[0], step->values[1]);
+			else if (step->kind == 1) hc165_set_chain(step->values);
+			else state = cpu_Done;
+		}
+		if (next == stepCount && state != cpu_Done) {
+			// no end line: stop after the last step
+			if (!stepCount || ms > steps[stepCount - 1].ms + 100) break;
+		}
+		if (state == cpu_Done) break;
+		if (!map) {
+			state = avr_run(avr);
+			continue;
+		}
+		unsigned long polls = pollCount(), scans = scanCount();
+		state = callstack_step(avr);
+		if (pollCount() != polls) callstack_mark(pollWindow, avr);
+		if (scanCount() != scans) callstack_mark(scanWindow, avr);
+	}
+
+	char text[21];
+	hd44780_row(&lcd1, 1, text); printf("LCD1 |%s|\n", text);
+	hd44780_row(&lcd1, 2, text); printf("LCD1 |%s|\n", text);
+	hd44780_row(&lcd2, 1, text); printf("LCD2 |%s|\n", text);
+	hd44780_row(&lcd2, 2, text); printf("LCD2 |%s|\n", text);
+
+	unsigned long scans;
+	avr_cycle_count_t min, max, total;
+	hc165_scan_stats(&scans, &min, &max, &total);
+	double us = 1e6 / avr->frequency;
+	printf("%.1f ms simulated, %lu reports, %lu scans\n", avr->cycle * 1000.0 / avr->frequency,
+		usb_capture_count(), scans);
+	if (scans > 1)
+		printf("scan period: min %.1f us, mean %.1f us, max %.1f us\n",
+			min * us, total * us / (scans - 1), max * us);
+	unsigned long polls;
+	avr_cycle_count_t pollGap;
+	usb_capture_poll_stats(&polls, &pollGap);
+	if (polls > 1)
+		printf("usbPoll(): %lu calls, longest gap %.1f us\n", polls, pollGap * us);
+	if (state == cpu_Crashed) return 1;
+
+	int over = 0;
+	if (map) {
+		over |= printWindow("usbPoll()", pollWindow, avr, pollBudget);
+		over |= printWindow("scan", scanWindow, avr, scanBudget);
+	}
+	return over ? 3 : 0;
+}
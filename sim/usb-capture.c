@@ -0,0 +1,77 @@
+#include "parts.h"
+
+// data space addresses on the ATmega168
+#define GPIOR0 0x3e
+#define GPIOR1 0x4a
+#define GPIOR2 0x4b
+
+#define POLL 0xff // HAL_SIM_POLL
+
+static uint8_t packet[8];
+static uint8_t length;
+static uint32_t intervalUs;
+static unsigned long count;
+static FILE *output;
+static usb_capture_fn onSend;
+
+static unsigned long polls;
+static avr_cycle_count_t lastPoll, maxPollGap;
+
+static avr_cycle_count_t endpointFree(avr_t *avr, avr_cycle_count_t when, void *param) {
+	avr->data[GPIOR2] = 1;
+	return 0;
+}
+
+static void payloadWritten(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+	avr->data[addr] = v;
+	if (length < sizeof(packet)) packet[length] = v;
+	length++;
+}
+
+static void lengthWritten(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+	avr->data[addr] = v;
+	if (v == POLL) {
+		if (polls++ && avr->cycle - lastPoll > maxPollGap) maxPollGap = avr->cycle - lastPoll;
+		lastPoll = avr->cycle;
+		return;
+	}
+
+	count++;
+	if (output) {
+		fprintf(output, "%10.3f ms:", avr->cycle * 1000.0 / avr->frequency);
+		for (uint8_t i = 0; i < v && i < sizeof(packet); i++) fprintf(output, " %02x", packet[i]);
+		if (v != length) fprintf(output, " (%u bytes written)", length);
+		fprintf(output, "\n");
+	}
+	if (onSend) onSend(avr, packet, v);
+	length = 0;
+	// busy until the host polls again
+	avr->data[GPIOR2] = 0;
+	avr_cycle_timer_register_usec(avr, intervalUs, endpointFree, NULL);
+}
+
+void usb_capture_init(avr_t *avr, uint8_t intervalMs, FILE *out) {
+	intervalUs = intervalMs * 1000UL;
+	output = out;
+	avr_register_io_write(avr, GPIOR0, payloadWritten, NULL);
+	avr_register_io_write(avr, GPIOR1, lengthWritten, NULL);
+	avr->data[GPIOR2] = 1;
+}
+
+void usb_capture_on_send(usb_capture_fn fn) {
+	onSend = fn;
+}
+
+unsigned long usb_capture_count(void) {
+	return count;
+}
+
+void usb_capture_poll_stats(unsigned long *count, avr_cycle_count_t *maxGap) {
+	*count = polls;
+	*maxGap = maxPollGap;
+}
+
+void usb_capture_reset_poll_stats(void) {
+	polls = 0;
+	maxPollGap = 0;
+}
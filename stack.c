@@ -0,0 +1,36 @@
+#include "stack.h"
+
+#if DIAG_STACK
+
+extern uint8_t _end;
+extern uint8_t __stack;
+
+stack_stats_t stack_stats;
+
+// runs before the stack pointer is set up, so no C
+void stack_paint(void) __attribute__((naked, used, section(".init1")));
+void stack_paint(void) {
+	__asm volatile (
+		"    ldi r30, lo8(_end)\n"
+		"    ldi r31, hi8(_end)\n"
+		"    ldi r24, %0\n"
+		"    ldi r25, hi8(__stack)\n"
+		"    rjmp 2f\n"
+		"1:  st Z+, r24\n"
+		"2:  cpi r30, lo8(__stack)\n"
+		"    cpc r31, r25\n"
+		"    brlo 1b\n"
+		"    breq 1b\n"
+		: : "i" (STACK_PAINT)
+	);
+}
+
+void stack_probe(void) {
+	const uint8_t *p = &_end;
+	while ((p <= &__stack) && (*p == STACK_PAINT)) p++;
+	stack_stats.dataEnd = (uint16_t)(uintptr_t)&_end;
+	stack_stats.stackTop = (uint16_t)(uintptr_t)&__stack;
+	stack_stats.unused = p - &_end;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __stack_h_included__
+#define __stack_h_included__
+
+#include <stdint.h>
+#include "diag.h"
+
+// The RAM between the end of the static data and the top of the stack is
+// painted with STACK_PAINT before main() runs. Bytes that still hold it
+// were never used, the lowest one that does not is the stack high water
+// mark (heap is not used in this firmware).
+
+#define STACK_PAINT 0xc5
+
+typedef struct {
+	uint16_t dataEnd;   // first byte after .data and .bss
+	uint16_t stackTop;  // RAMEND
+	uint16_t unused;    // bytes above dataEnd the stack never reached
+} stack_stats_t;
+
+#if DIAG_STACK
+
+extern stack_stats_t stack_stats;
+
+// updates stack_stats
+void stack_probe(void);
+
+#endif
+
+#endif
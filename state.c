@@ -0,0 +1,77 @@
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include "state.h"
+#include "profile.h"
+
+#define STATE_EEPROM_ADDRESS (PROFILE_EEPROM_ADDRESS + sizeof(profile_eeprom_t))
+#define STATE_ROOM (E2END + 1 - STATE_EEPROM_ADDRESS - 1) // minus the version byte
+
+#define STATE_STICKS (STATE_STICK_OFFSET(AXIS_REPORTS) <= STATE_ROOM ? AXIS_REPORTS : AXIS_PAGES)
+#define STATE_SIZE STATE_STICK_OFFSET(STATE_STICKS)
+typedef char state_fits_eeprom[(STATE_SIZE <= STATE_ROOM) ? 1 : -1];
+
+const uint8_t state_sticks = STATE_STICKS;
+
+#define eepromVersion ((uint8_t *)STATE_EEPROM_ADDRESS)
+#define eepromState   ((uint8_t *)STATE_EEPROM_ADDRESS + 1)
+
+// what the EEPROM holds (or will hold once the dirty bytes are written)
+static uint8_t saved[STATE_SIZE];
+static uint8_t dirty[(STATE_SIZE + 7) / 8];
+static uint8_t versionDirty;
+
+static uint8_t pending;
+static uint16_t lastChange;
+
+uint8_t state_load(uint8_t *dst) {
+	eeprom_read_block(saved, eepromState, STATE_SIZE);
+	if (eeprom_read_byte(eepromVersion) != STATE_VERSION) {
+		versionDirty = 1;
+		return 0;
+	}
+	memcpy(dst, saved, STATE_SIZE);
+	return 1;
+}
+
+void state_changed(uint16_t now) {
+	pending = 1;
+	lastChange = now;
+}
+
+uint8_t state_due(uint16_t now) {
+	return pending && ((uint16_t)(now - lastChange) >= STATE_SAVE_DELAY_MS);
+}
+
+void state_save(const uint8_t *src) {
+	pending = 0;
+	for (uint8_t i = 0; i < STATE_SIZE; i++) {
+		if (saved[i] != src[i]) {
+			saved[i] = src[i];
+			dirty[i / 8] |= 1 << (i % 8);
+		}
+	}
+}
+
+void state_poll(void) {
+	if (!eeprom_is_ready()) return;
+
+	for (uint8_t i = 0; i < sizeof(dirty); i++) {
+		if (!dirty[i]) continue;
+		uint8_t n = i * 8;
+		uint8_t mask = 1;
+		while (!(dirty[i] & mask)) {
+			mask <<= 1;
+			n++;
+		}
+		dirty[i] &= ~mask;
+		eeprom_write_byte(eepromState + n, saved[n]);
+		return;
+	}
+
+	// the version goes last, so a half written first save is not restored
+	if (versionDirty && !pending) {
+		versionDirty = 0;
+		eeprom_write_byte(eepromVersion, STATE_VERSION);
+	}
+}
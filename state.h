@@ -0,0 +1,36 @@
+#ifndef __state_h_included__
+#define __state_h_included__
+
+#include <stdint.h>
+#include "numsticks.h"
+
+// Runtime state kept across power cycles: the selected page and the axis
+// values of the sticks. It is stored behind the profile in EEPROM.
+//
+// Changes are collected until nothing has changed for STATE_SAVE_DELAY_MS,
+// then compared with the last saved copy; only the bytes that differ are
+// marked in a dirty bitmap and written, one per state_poll().
+
+#define STATE_VERSION 1
+#define STATE_SAVE_DELAY_MS 2000
+
+#define STATE_AXIS_BYTES (4 * AXIS_BITS / 8)
+// page, then the four axes of every axis report (AXIS_REPORTS, pages
+// first, then their shift layer) that fits in the EEPROM
+#define STATE_STICK_OFFSET(stick) (1 + (stick) * STATE_AXIS_BYTES)
+
+// number of axis reports whose axes are kept, all of them if there is room
+extern const uint8_t state_sticks;
+#define STATE_MAX_SIZE STATE_STICK_OFFSET(AXIS_REPORTS)
+
+// copies the saved state to dst, returns 0 if there is none
+uint8_t state_load(uint8_t *dst);
+// something in the state changed at time now (ms)
+void state_changed(uint16_t now);
+// returns 1 once the state has been quiet long enough to save it
+uint8_t state_due(uint16_t now);
+// marks the bytes of src that differ from the saved copy for writing
+void state_save(const uint8_t *src);
+void state_poll(void);
+
+#endif
@@ -0,0 +1,62 @@
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include "storage.h"
+
+// bytes compared per call while looking for one that needs writing
+#define STORAGE_COMPARE_BUDGET 8
+
+typedef struct {
+	uint8_t *dst;
+	const uint8_t *src;
+	uint16_t len;
+	uint8_t from;
+} storage_job_t;
+
+static storage_job_t jobs[STORAGE_QUEUE_LENGTH];
+static uint8_t first;
+static uint8_t count;
+
+void storage_init(void) {
+	first = count = 0;
+}
+
+uint8_t storage_write(void *dst, const void *src, uint16_t len, uint8_t from) {
+	if (count == STORAGE_QUEUE_LENGTH) return 0;
+	storage_job_t *job = &jobs[(first + count) % STORAGE_QUEUE_LENGTH];
+	job->dst = dst;
+	job->src = src;
+	job->len = len;
+	job->from = from;
+	count++;
+	return 1;
+}
+
+uint8_t storage_busy(void) {
+	return count || !eeprom_is_ready();
+}
+
+void storage_poll(void) {
+	uint8_t budget = STORAGE_COMPARE_BUDGET;
+
+	// reading the EEPROM would wait for a running write to finish
+	if (!eeprom_is_ready()) return;
+
+	while (count && budget--) {
+		storage_job_t *job = &jobs[first];
+		if (job->len == 0) {
+			first = (first + 1) % STORAGE_QUEUE_LENGTH;
+			count--;
+			continue;
+		}
+		uint8_t value = job->from == STORAGE_FROM_FLASH ? pgm_read_byte(job->src) : *job->src;
+		uint8_t *dst = job->dst;
+		job->src++;
+		job->dst++;
+		job->len--;
+		if (eeprom_read_byte(dst) != value) {
+			// starts the write and returns, the EEPROM is ready again in 3.3 ms
+			eeprom_write_byte(dst, value);
+			return;
+		}
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef __storage_h_included__
+#define __storage_h_included__
+
+#include <stdint.h>
+
+// Non-blocking EEPROM writer. A byte write takes 3.3 ms, so writes are
+// queued as jobs and storage_poll() starts at most one byte write per call,
+// and only when the previous one has finished. Bytes that already hold the
+// right value are skipped, so rewriting a block only wears the cells that
+// actually change.
+
+#define STORAGE_FROM_RAM   0
+#define STORAGE_FROM_FLASH 1
+
+#define STORAGE_QUEUE_LENGTH 4
+
+// copy len bytes from src (RAM or flash) to EEPROM address dst; src must
+// stay valid until storage_busy() returns 0. Returns 0 if the queue is full.
+uint8_t storage_write(void *dst, const void *src, uint16_t len, uint8_t from);
+
+// drops the queue, as a reset does (lets the host build cut the power)
+void storage_init(void);
+uint8_t storage_busy(void);
+void storage_poll(void);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stddef.h>
+#include <string.h>
+#include "trace.h"
+
+#if DIAG_TRACE
+
+static uint8_t ring[DIAG_TRACE_SIZE];
+static uint16_t head;  // next byte to write
+static uint16_t tail;  // oldest record
+static uint16_t used;
+
+static uint16_t now;
+static uint16_t lastMs;
+static uint8_t chain[TRACE_CHAIN_BYTES];
+static trace_header_t header;
+// streamed from memory: the fields up to the chain bytes must not be padded
+typedef char trace_header_layout[(offsetof(trace_header_t, baseChain) == TRACE_HEADER_SIZE - TRACE_CHAIN_BYTES) ? 1 : -1];
+static int16_t postTrigger;
+static uint8_t reading;
+static uint16_t readPos;
+static uint16_t readEnd;
+
+// payload bytes per record type, snapshots add one per changed byte
+static const uint8_t payloadSize[8] = { 1, 2, 1, 1, 1, 0, 0, 0 };
+
+static uint8_t peek(uint16_t pos) {
+	return ring[pos % DIAG_TRACE_SIZE];
+}
+
+static void put(uint8_t byte) {
+	ring[head] = byte;
+	if (++head == DIAG_TRACE_SIZE) head = 0;
+}
+
+// drops the oldest record, its time and chain bytes go into the base
+static void drop(void) {
+	uint8_t h = ring[tail];
+	uint8_t type = h >> 5;
+	uint8_t len = 1 + payloadSize[type];
+	uint16_t delta = h & 0x1f;
+	if (delta == 31) {
+		delta += peek(tail + 1);
+		len++;
+	}
+	header.baseMs += delta;
+	if (type == TRACE_REC_SNAPSHOT) {
+		uint16_t pos = tail + len - 1; // the mask
+		uint8_t mask = peek(pos);
+		for (uint8_t i=0; i<TRACE_CHAIN_BYTES; i++) {
+			if (mask & (1<<i)) {
+				header.baseChain[i] = peek(++pos);
+				len++;
+			}
+		}
+	}
+	tail = (tail + len) % DIAG_TRACE_SIZE;
+	used -= len;
+}
+
+// writes the header byte of a record with payload bytes following,
+// returns 0 while the ring does not take records
+static uint8_t begin(uint8_t type, uint8_t payload) {
+	if ((header.flags & TRACE_FROZEN) || reading) return 0;
+
+	uint16_t delta = now - lastMs;
+	lastMs = now;
+	uint8_t len = 1 + payload + (delta >= 31);
+	while (DIAG_TRACE_SIZE - used < len) drop();
+	used += len;
+
+	if (delta >= 31) {
+		put((type << 5) | 31);
+		put(delta - 31 > 255 ? 255 : delta - 31);
+	} else {
+		put((type << 5) | delta);
+	}
+
+	if (header.flags & TRACE_TRIGGERED) {
+		postTrigger -= len;
+		if (postTrigger <= 0) header.flags |= TRACE_FROZEN;
+	}
+	return 1;
+}
+
+void trace_tick(uint16_t ms) {
+	now = ms;
+}
+
+void trace_snapshot(const uint8_t *bytes) {
+	uint8_t mask = 0, count = 0;
+	for (uint8_t i=0; i<TRACE_CHAIN_BYTES; i++) {
+		if (bytes[i] != chain[i]) {
+			mask |= 1<<i;
+			count++;
+		}
+	}
+	if (!mask || !begin(TRACE_REC_SNAPSHOT, 1 + count)) return;
+	put(mask);
+	for (uint8_t i=0; i<TRACE_CHAIN_BYTES; i++) {
+		if (mask & (1<<i)) {
+			chain[i] = bytes[i];
+			put(chain[i]);
+		}
+	}
+}
+
+void trace_events(uint8_t encoder, uint8_t events) {
+	if (!begin(TRACE_REC_EVENTS, 2)) return;
+	put(encoder);
+	put(events);
+}
+
+void trace_page(uint8_t page) {
+	if (begin(TRACE_REC_PAGE, 1)) put(page);
+}
+
+void trace_report(uint8_t reportId) {
+	if (begin(TRACE_REC_REPORT, 1)) put(reportId);
+}
+
+void trace_trigger(uint8_t cause) {
+	if (header.flags & TRACE_TRIGGERED) return;
+	if (!begin(TRACE_REC_TRIGGER, 1)) return;
+	put(cause);
+	header.flags |= TRACE_TRIGGERED;
+	header.cause = cause;
+	postTrigger = TRACE_POST_TRIGGER;
+}
+
+void trace_freeze(void) {
+	trace_trigger(TRACE_CAUSE_HOST);
+	header.flags |= TRACE_FROZEN;
+}
+
+void trace_rearm(void) {
+	head = tail = used = 0;
+	header.flags = 0;
+	header.cause = 0;
+	header.baseMs = lastMs = now;
+	memcpy(header.baseChain, chain, TRACE_CHAIN_BYTES);
+}
+
+void trace_read_start(uint16_t length) {
+	header.length = used;
+	readPos = 0;
+	// the driver stops asking after wLength bytes, so the stream must end there
+	readEnd = TRACE_HEADER_SIZE + used;
+	if (length < readEnd) readEnd = length;
+	reading = readEnd != 0;
+}
+
+void trace_read_stop(void) {
+	reading = 0;
+}
+
+uint8_t trace_read(uint8_t *data, uint8_t len) {
+	uint8_t i = 0;
+	while ((i < len) && (readPos < readEnd)) {
+		if (readPos < TRACE_HEADER_SIZE)
+			data[i] = ((uint8_t *)&header)[readPos];
+		else
+			data[i] = peek(tail + readPos - TRACE_HEADER_SIZE);
+		i++;
+		readPos++;
+	}
+	if (readPos == readEnd) reading = 0;
+	return i;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef __trace_h_included__
+#define __trace_h_included__
+
+#include <stdint.h>
+#include "diag.h"
+#include "numsticks.h"
+
+// Event trace: a ring of variable length records in SRAM, oldest ones are
+// dropped when it is full. Every record starts with a header byte, record
+// type in the upper three bits and the milliseconds since the previous
+// record in the lower five. A delta of 31 means an extra byte with
+// delta - 31 follows (gaps longer than 286ms are shortened to that).
+//
+// A trigger records TRACE_REC_TRIGGER, keeps recording for another
+// TRACE_POST_TRIGGER bytes and then freezes the ring until the host
+// rearms it (RQ_FREEZE_TRACE).
+//
+// GET_TRACE reply: trace_header_t, then the records from oldest to newest.
+// Recording pauses while the reply is read.
+
+#define TRACE_REC_SNAPSHOT 0 // mask of changed chain bytes, the changed bytes
+#define TRACE_REC_EVENTS   1 // encoder, ECEV_* bits
+#define TRACE_REC_PAGE     2 // selected page
+#define TRACE_REC_REPORT   3 // report ID handed to usbSetInterrupt()
+#define TRACE_REC_TRIGGER  4 // TRACE_CAUSE_*
+
+#define TRACE_CAUSE_HOST    1
+#define TRACE_CAUSE_ILLEGAL 2 // an encoder skipped a quadrature state
+
+#define TRACE_POST_TRIGGER (DIAG_TRACE_SIZE / 4)
+
+// a snapshot's mask has one bit per chain byte
+#define TRACE_CHAIN_BYTES CHAIN_BYTES
+#if DIAG_TRACE && TRACE_CHAIN_BYTES > 8
+#error "trace snapshots take up to 8 chain bytes"
+#endif
+
+// trace_header_t.flags
+#define TRACE_TRIGGERED (1<<0)
+#define TRACE_FROZEN    (1<<1)
+
+typedef struct {
+	uint8_t flags;
+	uint8_t cause;
+	uint16_t length;  // record bytes following the header
+	// state before the oldest record: time and chain bytes
+	uint16_t baseMs;
+	uint8_t baseChain[TRACE_CHAIN_BYTES];
+} trace_header_t;
+
+// bytes of the header in a GET_TRACE reply, little endian in field order.
+// With an odd TRACE_CHAIN_BYTES a host compiler pads the struct at the end
+// and avr-gcc does not, so the stream goes by this and never by sizeof.
+#define TRACE_HEADER_SIZE (6 + TRACE_CHAIN_BYTES)
+
+#if DIAG_TRACE
+
+void trace_tick(uint16_t ms);
+void trace_snapshot(const uint8_t *chain);
+void trace_events(uint8_t encoder, uint8_t events);
+void trace_page(uint8_t page);
+void trace_report(uint8_t reportId);
+void trace_trigger(uint8_t cause);
+
+// host control, see diag.h
+void trace_freeze(void);
+void trace_rearm(void);
+// GET_TRACE stream, at most length bytes (the request's wLength)
+void trace_read_start(uint16_t length);
+void trace_read_stop(void);
+uint8_t trace_read(uint8_t *data, uint8_t len);
+
+#define TRACE_TICK(ms)              trace_tick(ms)
+#define TRACE_SNAPSHOT(chain)       trace_snapshot(chain)
+#define TRACE_EVENTS(enc, events)   trace_events(enc, events)
+#define TRACE_PAGE(page)            trace_page(page)
+#define TRACE_REPORT(reportId)      trace_report(reportId)
+#define TRACE_TRIGGER(cause)        trace_trigger(cause)
+
+#else
+
+#define TRACE_TICK(ms)
+#define TRACE_SNAPSHOT(chain)
+#define TRACE_EVENTS(enc, events)
+#define TRACE_PAGE(page)
+#define TRACE_REPORT(reportId)
+#define TRACE_TRIGGER(cause)
+
+#endif
+
+#endif